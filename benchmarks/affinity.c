@@ -0,0 +1,115 @@
+#include "muco.h"
+#include "muco/channel.h"
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <error.h>
+#include <time.h>
+
+// Pairs of fibers exchange messages over their own channel, each fiber
+// walking its own working set of WSS bytes for every message. Woken fibers
+// are enqueued either on the waker's scheduler (local), or back on the
+// scheduler that last resumed them (home), or fibers pin themselves to the
+// scheduler they first ran on (pin).
+
+#define COUNT (1000000ULL)
+#define WSS (16 * 1024)
+
+static co_chan_t *chans;
+static atomic_ulong done;
+static atomic_ulong producers, consumers;
+static long count;
+static int pin;
+struct timespec start, stop;
+
+static unsigned long walk(unsigned char *ws) {
+    unsigned long sum = 0;
+    for (size_t i = 0; i < WSS; i += 64) {
+        sum += ws[i]++;
+    }
+    return sum;
+}
+
+static void finish() {
+    unsigned long old = atomic_fetch_sub(&done, 1);
+    if (old == 1) co_break();
+}
+
+static void producer() {
+    co_chan_t *chan = &chans[atomic_fetch_add(&producers, 1)];
+    unsigned char *ws = calloc(1, WSS);
+    if (pin) co_pin();
+
+    for (long i = 0; i < count; i++) {
+        walk(ws);
+        co_chan_send(chan, (void *)i);
+    }
+    co_chan_close(chan);
+
+    free(ws);
+    finish();
+}
+
+static void consumer() {
+    co_chan_t *chan = &chans[atomic_fetch_add(&consumers, 1)];
+    unsigned char *ws = calloc(1, WSS);
+    void *value;
+    if (pin) co_pin();
+
+    while (co_chan_receive(chan, &value) == 0) {
+        walk(ws);
+    }
+
+    free(ws);
+    finish();
+}
+
+int main(int argc, char *argv[]) {
+    char *kind = argc > 1 ? argv[1] : "home";
+    unsigned long pcount = argc > 2 ? atol(argv[2]) : 4;
+
+    pin = strcmp(kind, "pin") == 0;
+    count = COUNT / pcount;
+    atomic_init(&done, pcount * 2);
+    atomic_init(&producers, 0);
+    atomic_init(&consumers, 0);
+
+    co_init(co_procs());
+    if (strcmp(kind, "home") == 0) {
+        co_set_wake_policy(CO_WAKE_HOME);
+    }
+
+    chans = calloc(pcount, sizeof(co_chan_t));
+    for (unsigned long i = 0; i < pcount; i++) {
+        co_chan_init(&chans[i], 16, 1);
+    }
+
+    for (unsigned long i = 0; i < pcount; i++) {
+        co_spawn(producer);
+        co_spawn(consumer);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    co_run();
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+
+    unsigned long long duration =
+        (stop.tv_sec * 1000 + stop.tv_nsec / 1000000) -
+        (start.tv_sec * 1000 + start.tv_nsec / 1000000);
+
+    // should never happen:
+    if (duration == 0) duration = 1;
+
+    printf("affinity[%d/%lu]: %s: %llu messages in %lld ms, %lld messages per second (migrations=%lu)\n",
+            co_nprocs(), pcount, kind, COUNT, duration, ((1000LL * COUNT) / duration),
+            co_migrations());
+
+    for (unsigned long i = 0; i < pcount; i++) {
+        co_chan_destroy(&chans[i]);
+    }
+    free(chans);
+    co_free();
+    return 0;
+}
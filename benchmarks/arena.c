@@ -0,0 +1,89 @@
+#include "muco.h"
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Short-lived request fibers build a linked list of small nodes then exit,
+// allocating either with malloc (and freeing every node) or from the fiber's
+// arena (released when the fiber exits).
+
+#define COUNT (200000ULL)
+#define ALLOCS (64)
+
+typedef struct node {
+    struct node *next;
+    unsigned long value;
+    char payload[40];
+} node_t;
+
+static atomic_ulong done;
+static atomic_long remaining;
+static atomic_ulong checksum;
+static int arena;
+struct timespec start, stop;
+
+static void request() {
+    node_t *head = NULL;
+    unsigned long sum = 0;
+
+    for (unsigned long i = 0; i < ALLOCS; i++) {
+        node_t *node = arena ? co_arena_alloc(sizeof(node_t)) : malloc(sizeof(node_t));
+        node->value = i;
+        node->next = head;
+        head = node;
+    }
+
+    while (head) {
+        node_t *next = head->next;
+        sum += head->value;
+        if (!arena) free(head);
+        head = next;
+    }
+    atomic_fetch_add_explicit(&checksum, sum, memory_order_relaxed);
+
+    // each request spawns the next request of its chain then exits, so its
+    // arena is released before the next one allocates:
+    if (atomic_fetch_sub(&remaining, 1) > 0) {
+        co_spawn(request);
+        return;
+    }
+
+    unsigned long old = atomic_fetch_sub(&done, 1);
+    if (old == 1) co_break();
+}
+
+int main(int argc, char *argv[]) {
+    char *kind = argc > 1 ? argv[1] : "arena";
+    unsigned long scount = argc > 2 ? atol(argv[2]) : 4;
+
+    arena = strcmp(kind, "malloc") != 0;
+    atomic_init(&done, scount);
+    atomic_init(&remaining, COUNT);
+    atomic_init(&checksum, 0);
+
+    co_init(co_procs());
+
+    for (unsigned long i = 0; i < scount; i++) {
+        co_spawn(request);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    co_run();
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+
+    unsigned long long duration =
+        (stop.tv_sec * 1000 + stop.tv_nsec / 1000000) -
+        (start.tv_sec * 1000 + start.tv_nsec / 1000000);
+
+    // should never happen:
+    if (duration == 0) duration = 1;
+
+    printf("arena[%d/%lu]: %s: %llu requests in %lld ms, %lld requests per second (%d allocations each, checksum=%lu)\n",
+            co_nprocs(), scount, kind, COUNT, duration, ((1000LL * COUNT) / duration), ALLOCS,
+            atomic_load(&checksum));
+    co_free();
+
+    return 0;
+}
@@ -0,0 +1,128 @@
+#include "muco.h"
+#include "muco/broadcast.h"
+#include "muco/channel.h"
+#include <error.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define COUNT (1000000ULL)
+#define CAPACITY (1024)
+
+// Fans out events from one publisher to many subscribers, either through one
+// channel per subscriber (N sends per event) or a single broadcast channel.
+//
+// Usage: broadcast [chan|bcast] [subscribers]
+
+atomic_ulong done;
+unsigned long scount = 8;
+struct timespec start, stop;
+
+static co_chan_t *chans;
+static co_bcast_t bcast;
+static co_bcast_sub_t *subs;
+static atomic_ulong next_sub;
+
+static void chan_publish() {
+    long i = COUNT;
+
+    while (i--) {
+        for (unsigned long j = 0; j < scount; j++) {
+            if (co_chan_send(&chans[j], (void *)i)) {
+                error(1, 0, "chan is closed");
+            }
+        }
+    }
+    for (unsigned long j = 0; j < scount; j++) {
+        co_chan_close(&chans[j]);
+    }
+}
+
+static void chan_subscribe() {
+    co_chan_t *chan = &chans[atomic_fetch_add(&next_sub, 1)];
+    long i;
+
+    while (!co_chan_receive(chan, (void *)&i));
+
+    if (atomic_fetch_sub(&done, 1) == 1) {
+        co_break();
+    }
+}
+
+static void bcast_publish() {
+    long i = COUNT;
+
+    while (i--) {
+        if (co_bcast_publish(&bcast, (void *)i)) {
+            error(1, 0, "bcast is closed");
+        }
+    }
+    co_bcast_close(&bcast);
+}
+
+static void bcast_subscribe() {
+    co_bcast_sub_t *sub = &subs[atomic_fetch_add(&next_sub, 1)];
+    long i;
+
+    while (!co_bcast_receive(sub, (void *)&i));
+
+    if (atomic_fetch_sub(&done, 1) == 1) {
+        co_break();
+    }
+}
+
+int main(int argc, char **argv) {
+    char *kind = argc > 1 ? argv[1] : "bcast";
+    if (argc > 2) scount = atol(argv[2]);
+
+    atomic_init(&done, scount);
+    atomic_init(&next_sub, 0);
+
+    co_init(co_procs());
+
+    if (strcmp(kind, "chan") == 0) {
+        chans = calloc(scount, sizeof(co_chan_t));
+        for (unsigned long j = 0; j < scount; j++) {
+            co_chan_init(&chans[j], CAPACITY, 1);
+            co_spawn_named(chan_subscribe, "sub");
+        }
+        co_spawn_named(chan_publish, "pub");
+    } else {
+        kind = "bcast";
+        co_bcast_init(&bcast, CAPACITY, CO_BCAST_BLOCK);
+        subs = calloc(scount, sizeof(co_bcast_sub_t));
+        for (unsigned long j = 0; j < scount; j++) {
+            co_bcast_subscribe(&bcast, &subs[j]);
+            co_spawn_named(bcast_subscribe, "sub");
+        }
+        co_spawn_named(bcast_publish, "pub");
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    co_run();
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+
+    unsigned long long duration =
+        (stop.tv_sec * 1000 + stop.tv_nsec / 1000000) -
+        (start.tv_sec * 1000 + start.tv_nsec / 1000000);
+
+    // should never happen:
+    if (duration == 0) duration = 1;
+
+    printf("broadcast[%d/%lu]: %s: %llu events in %lld ms, %lld events per second\n",
+            co_nprocs(), scount, kind, COUNT, duration, ((1000LL * COUNT) / duration));
+
+    if (kind[0] == 'c') {
+        for (unsigned long j = 0; j < scount; j++) {
+            co_chan_destroy(&chans[j]);
+        }
+        free(chans);
+    } else {
+        co_bcast_destroy(&bcast);
+        free(subs);
+    }
+    co_free();
+
+    return 0;
+}
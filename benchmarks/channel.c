@@ -80,8 +80,9 @@ int main(int argc, char **argv) {
     // should never happen:
     if (duration == 0) duration = 1;
 
-    printf("channel[%d/%lu]: muco: %llu messages in %lld ms, %lld messages per second\n",
-            co_nprocs, cocount, COUNT, duration, ((1000LL * COUNT) / duration));
+    printf("channel[%d/%lu]: muco: %llu messages in %lld ms, %lld messages per second (migrations=%lu)\n",
+            co_nprocs(), cocount, COUNT, duration, ((1000LL * COUNT) / duration),
+            co_migrations());
 
     co_chan_destroy(&chan);
     co_free();
@@ -0,0 +1,82 @@
+#include "muco.h"
+#include "muco/generator.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// A fiber sums the integers produced by an iterator: either a generator,
+// resumed for every integer, or a function calling back for every integer
+// (the usual alternative, that inverts the control flow of the consumer).
+
+#define COUNT (10000000ULL)
+
+static unsigned long count;
+static uint64_t sum;
+struct timespec start, stop;
+
+static void produce(void *arg) {
+    unsigned long n = (uintptr_t)arg;
+
+    for (unsigned long i = 0; i < n; i++) {
+        co_gen_yield((void *)i);
+    }
+}
+
+static void consume(uint64_t value, void *ctx) {
+    *(uint64_t *)ctx += value;
+}
+
+// not inlined, so the callback is an indirect call, as it would be across a
+// library boundary:
+__attribute__((noinline))
+static void iterate(unsigned long n, void (*callback)(uint64_t, void *), void *ctx) {
+    for (unsigned long i = 0; i < n; i++) {
+        callback(i, ctx);
+    }
+}
+
+static void generator() {
+    co_gen_t gen;
+    void *value;
+
+    co_gen_init(&gen, produce, (void *)(uintptr_t)count);
+    while (co_gen_next(&gen, &value) == 0) {
+        sum += (uintptr_t)value;
+    }
+    co_gen_destroy(&gen);
+
+    co_break();
+}
+
+static void callback() {
+    iterate(count, consume, &sum);
+    co_break();
+}
+
+int main(int argc, char *argv[]) {
+    char *kind = argc > 1 ? argv[1] : "generator";
+    count = COUNT;
+
+    co_init(co_procs());
+    co_spawn(strcmp(kind, "callback") == 0 ? callback : generator);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    co_run();
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+
+    unsigned long long duration =
+        (stop.tv_sec * 1000 + stop.tv_nsec / 1000000) -
+        (start.tv_sec * 1000 + start.tv_nsec / 1000000);
+
+    // should never happen:
+    if (duration == 0) duration = 1;
+
+    printf("generator[%d]: %s: %llu items in %lld ms, %lld items per second (%.2f ns per item, sum=%lu)\n",
+            co_nprocs(), kind, COUNT, duration, ((1000LL * COUNT) / duration),
+            duration * 1000000.0 / COUNT, (unsigned long)sum);
+    co_free();
+
+    return 0;
+}
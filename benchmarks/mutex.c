@@ -9,19 +9,43 @@
 
 #define COUNT (10000000ULL)
 
+// measure lock acquisition latency once every SAMPLE locks:
+#define SAMPLE (64)
+
 static co_mtx_t mutex;
 static unsigned long long increment = 0;
 atomic_ulong done;
 long count;
+long yield_every;
 unsigned long cocount;
 struct timespec start, stop;
 
+static uint64_t *latencies;
+static atomic_ulong nlatencies;
+
+static inline uint64_t now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
 static void locktask() {
     int i = count;
 
     while (i--) {
-        co_mtx_lock(&mutex);
+        if (i % SAMPLE == 0) {
+            uint64_t t = now();
+            co_mtx_lock(&mutex);
+            latencies[atomic_fetch_add(&nlatencies, 1)] = now() - t;
+        } else {
+            co_mtx_lock(&mutex);
+        }
         increment += 1;
+
+        // simulate a fiber being suspended while holding the lock:
+        if (yield_every && i % yield_every == 0) {
+            co_yield();
+        }
         co_mtx_unlock(&mutex);
     }
 
@@ -29,11 +53,20 @@ static void locktask() {
     if (old == 1) co_break();
 }
 
+static int compare(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
 int main(int argc, char *argv[]) {
     unsigned long cocount = argc > 1 ? atol(argv[1]) : 2;
+    yield_every = argc > 2 ? atol(argv[2]) : 0;
     count = COUNT / cocount;
     atomic_init(&done, cocount);
 
+    latencies = calloc(COUNT / SAMPLE + cocount, sizeof(uint64_t));
+    atomic_init(&nlatencies, 0);
+
     co_init(co_procs());
     co_mtx_init(&mutex);
 
@@ -52,9 +85,15 @@ int main(int argc, char *argv[]) {
     // should never happen:
     if (duration == 0) duration = 1;
 
-    printf("switch[%d/%lu]: muco: %llu locks in %lld ms, %lld locks per second (increment=%llu)\n",
-            co_nprocs, cocount, COUNT, duration, ((1000LL * COUNT) / duration), increment);
+    unsigned long n = atomic_load(&nlatencies);
+    qsort(latencies, n, sizeof(uint64_t), compare);
+
+    printf("mutex[%d/%lu]: muco: %llu locks in %lld ms, %lld locks per second (increment=%llu)\n",
+            co_nprocs(), cocount, COUNT, duration, ((1000LL * COUNT) / duration), increment);
+    printf("mutex[%d/%lu]: muco: lock latency p50=%lu ns p99=%lu ns max=%lu ns\n",
+            co_nprocs(), cocount, latencies[n / 2], latencies[n * 99 / 100], latencies[n - 1]);
 
+    free(latencies);
     co_free();
     return 0;
 }
@@ -0,0 +1,128 @@
+#include "muco.h"
+#include "muco/parallel.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <error.h>
+#include <time.h>
+
+// Data-parallel loops with lazy binary splitting: the sum of an array
+// (reduce), a histogram of an array (reduce into 256 bins), and a dense
+// matrix-vector product (for, one row per iteration). Each loop is repeated
+// ROUNDS times.
+
+#define ROUNDS (10)
+#define GRAIN (1024)
+#define BINS (256)
+
+static char *kind;
+static size_t size;
+static uint32_t *array;
+static double *matrix, *vector, *output;
+static uint64_t check;
+struct timespec start, stop;
+
+static void sum(size_t begin, size_t end, void *acc, void *ctx) {
+    (void)ctx;
+    uint64_t s = 0;
+    for (size_t i = begin; i < end; i++) s += array[i];
+    *(uint64_t *)acc += s;
+}
+
+static void sum_combine(void *acc, const void *other, void *ctx) {
+    (void)ctx;
+    *(uint64_t *)acc += *(const uint64_t *)other;
+}
+
+static void histogram(size_t begin, size_t end, void *acc, void *ctx) {
+    (void)ctx;
+    uint64_t *bins = acc;
+    for (size_t i = begin; i < end; i++) bins[array[i] & (BINS - 1)]++;
+}
+
+static void histogram_combine(void *acc, const void *other, void *ctx) {
+    (void)ctx;
+    uint64_t *bins = acc;
+    const uint64_t *more = other;
+    for (int i = 0; i < BINS; i++) bins[i] += more[i];
+}
+
+static void matvec(size_t begin, size_t end, void *ctx) {
+    (void)ctx;
+    for (size_t r = begin; r < end; r++) {
+        double *row = &matrix[r * size];
+        double s = 0;
+        for (size_t c = 0; c < size; c++) s += row[c] * vector[c];
+        output[r] = s;
+    }
+}
+
+static void run() {
+    for (int round = 0; round < ROUNDS; round++) {
+        if (strcmp(kind, "histogram") == 0) {
+            uint64_t bins[BINS], identity[BINS];
+            memset(identity, 0, sizeof(identity));
+            memcpy(bins, identity, sizeof(bins));
+            co_parallel_reduce(0, size, GRAIN, bins, sizeof(bins), identity,
+                    histogram, histogram_combine, NULL);
+            check = bins[0];
+        } else if (strcmp(kind, "matvec") == 0) {
+            // rows are already large:
+            co_parallel_for(0, size, 4, matvec, NULL);
+            check = (uint64_t)output[0];
+        } else {
+            uint64_t acc = 0, identity = 0;
+            co_parallel_reduce(0, size, GRAIN, &acc, sizeof(acc), &identity,
+                    sum, sum_combine, NULL);
+            check = acc;
+        }
+    }
+    co_break();
+}
+
+int main(int argc, char *argv[]) {
+    kind = argc > 1 ? argv[1] : "sum";
+    int mv = strcmp(kind, "matvec") == 0;
+    size = argc > 2 ? (size_t)atol(argv[2]) : (mv ? 2048 : 16 * 1024 * 1024);
+
+    if (mv) {
+        matrix = malloc(sizeof(double) * size * size);
+        vector = malloc(sizeof(double) * size);
+        output = malloc(sizeof(double) * size);
+        if (!matrix || !vector || !output) error(1, errno, "malloc");
+        for (size_t i = 0; i < size * size; i++) matrix[i] = (double)(i % 7);
+        for (size_t i = 0; i < size; i++) vector[i] = 1.0;
+    } else {
+        array = malloc(sizeof(uint32_t) * size);
+        if (!array) error(1, errno, "malloc");
+        for (size_t i = 0; i < size; i++) array[i] = (uint32_t)(i * 2654435761U);
+    }
+
+    co_init(co_procs());
+    co_spawn(run);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    co_run();
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+
+    unsigned long long duration =
+        (stop.tv_sec * 1000 + stop.tv_nsec / 1000000) -
+        (start.tv_sec * 1000 + start.tv_nsec / 1000000);
+
+    // should never happen:
+    if (duration == 0) duration = 1;
+
+    unsigned long long count = ROUNDS * (mv ? size * size : size);
+    printf("parallel[%d/%zu]: %s: %llu elements in %lld ms, %lld elements per second (check=%lu, migrations=%lu)\n",
+            co_nprocs(), size, kind, count, duration, ((1000LL * count) / duration),
+            check, co_migrations());
+
+    free(array);
+    free(matrix);
+    free(vector);
+    free(output);
+    co_free();
+    return 0;
+}
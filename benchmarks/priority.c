@@ -0,0 +1,160 @@
+#include "muco.h"
+#include "muco/channel.h"
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <error.h>
+#include <time.h>
+
+// Foreground fibers ping-pong over channels, measuring each round-trip, while
+// background fibers burn CPU. Background fibers suspend after each slice of
+// WORK iterations, and the pinger wakes them all at once right after sending,
+// so a bulk of background fibers is enqueued after the ponger.
+
+#define ROUNDS (20000ULL)
+#define WORK (10000)
+
+static co_chan_t ping, pong;
+static atomic_int stop;
+static atomic_ulong done;
+static atomic_ulong work;
+static atomic_ulong alive;
+static _Atomic(fiber_t *) sleeping;
+static int priorities;
+struct timespec start, stop_ts;
+
+static uint64_t *latencies;
+
+static inline uint64_t now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void finish() {
+    unsigned long old = atomic_fetch_sub(&done, 1);
+    if (old == 1) co_break();
+}
+
+static void slice() {
+    volatile unsigned long x = 0;
+    for (int i = 0; i < WORK; i++) x += i;
+}
+
+static void sleep_action(void *data) {
+    fiber_t *fiber = data;
+    fiber_t *head = atomic_load(&sleeping);
+
+    do {
+        fiber->m_next = head;
+    } while (!atomic_compare_exchange_weak(&sleeping, &head, fiber));
+}
+
+static void background() {
+    unsigned long n = 0;
+
+    while (!atomic_load_explicit(&stop, memory_order_relaxed)) {
+        slice();
+        n++;
+
+        // wait for the driver to wake all the background fibers at once:
+        co_suspend_then(sleep_action, co_current());
+    }
+    atomic_fetch_add(&work, n);
+    atomic_fetch_sub(&alive, 1);
+}
+
+static void wakeup_background() {
+    fiber_t *list = atomic_exchange(&sleeping, NULL);
+    if (list) co_enqueue_list(list);
+}
+
+static void pinger() {
+    void *value;
+
+    for (unsigned long i = 0; i < ROUNDS; i++) {
+        uint64_t t = now();
+        co_chan_send(&ping, (void *)i);
+        wakeup_background();
+        co_chan_receive(&pong, &value);
+        latencies[i] = now() - t;
+    }
+    co_chan_close(&ping);
+
+    // stop background fibers:
+    atomic_store(&stop, 1);
+    while (atomic_load(&alive) > 0) {
+        wakeup_background();
+        co_yield();
+    }
+    finish();
+}
+
+static void ponger() {
+    void *value;
+
+    while (co_chan_receive(&ping, &value) == 0) {
+        co_chan_send(&pong, value);
+    }
+    finish();
+}
+
+static int compare(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+int main(int argc, char *argv[]) {
+    char *kind = argc > 1 ? argv[1] : "high";
+    unsigned long bcount = argc > 2 ? atol(argv[2]) : 8;
+    priorities = strcmp(kind, "normal") != 0;
+
+    latencies = calloc(ROUNDS, sizeof(uint64_t));
+    atomic_init(&stop, 0);
+    atomic_init(&work, 0);
+    atomic_init(&done, 2);
+    atomic_init(&alive, bcount);
+    atomic_init(&sleeping, NULL);
+
+    co_init(co_procs());
+    co_chan_init(&ping, 1, 1);
+    co_chan_init(&pong, 1, 1);
+
+    co_priority_t fg = priorities ? CO_PRIORITY_HIGH : CO_PRIORITY_NORMAL;
+    co_priority_t bg = priorities ? CO_PRIORITY_BACKGROUND : CO_PRIORITY_NORMAL;
+
+    co_spawn_priority(ponger, fg);
+    co_spawn_priority(pinger, fg);
+
+    for (unsigned long i = 0; i < bcount; i++) {
+        co_spawn_priority(background, bg);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    co_run();
+    clock_gettime(CLOCK_MONOTONIC, &stop_ts);
+
+    unsigned long long duration =
+        (stop_ts.tv_sec * 1000 + stop_ts.tv_nsec / 1000000) -
+        (start.tv_sec * 1000 + start.tv_nsec / 1000000);
+
+    // should never happen:
+    if (duration == 0) duration = 1;
+
+    qsort(latencies, ROUNDS, sizeof(uint64_t), compare);
+
+    printf("priority[%d/%lu]: %s: %llu round-trips in %lld ms, %lld round-trips per second (background work=%lu)\n",
+            co_nprocs(), bcount, kind, ROUNDS, duration, ((1000LL * ROUNDS) / duration),
+            atomic_load(&work));
+    printf("priority[%d/%lu]: %s: round-trip latency p50=%lu ns p99=%lu ns max=%lu ns\n",
+            co_nprocs(), bcount, kind, latencies[ROUNDS / 2], latencies[ROUNDS * 99 / 100],
+            latencies[ROUNDS - 1]);
+
+    co_chan_destroy(&ping);
+    co_chan_destroy(&pong);
+    free(latencies);
+    co_free();
+    return 0;
+}
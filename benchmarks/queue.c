@@ -122,8 +122,8 @@ int main(int argc, char *argv[]) {
     // should never happen:
     if (duration == 0) duration = 1;
 
-    printf("queue[%d/%lu]: muco: %llu values in %lld ms, %lld values per second (result=%lu)\n",
-            co_nprocs, cocount, COUNT, duration, ((1000LL * COUNT) / duration), result);
+    printf("queue[%d/%lu]: muco: %llu values in %lld ms, %lld values per second (result=%lu, switches=%lu)\n",
+            co_nprocs(), cocount, COUNT, duration, ((1000LL * COUNT) / duration), result, co_switches());
 
     queue_destroy(&qu);
     co_free();
@@ -0,0 +1,91 @@
+#include "muco.h"
+#include "muco/mutex.h"
+#include "muco/rwlock.h"
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define COUNT (10000000ULL)
+#define SIZE (64)
+
+// Read-mostly workload: 95% of operations read a shared table, 5% update it,
+// guarded by either a mutex or a reader-writer lock.
+//
+// Usage: rwlock [mutex|rwlock|rwlock-reader] [fibers]
+
+static co_mtx_t mutex;
+static co_rwlock_t rwlock;
+static int use_mutex;
+static unsigned long table[SIZE];
+static atomic_ulong result;
+
+atomic_ulong done;
+long count;
+struct timespec start, stop;
+
+static void locktask() {
+    unsigned long sum = 0;
+    long i = count;
+
+    while (i--) {
+        if (i % 20 == 0) {
+            if (use_mutex) co_mtx_lock(&mutex); else co_rwlock_wrlock(&rwlock);
+            table[i % SIZE] += 1;
+            if (use_mutex) co_mtx_unlock(&mutex); else co_rwlock_unlock(&rwlock);
+        } else {
+            if (use_mutex) co_mtx_lock(&mutex); else co_rwlock_rdlock(&rwlock);
+            sum += table[i % SIZE];
+            if (use_mutex) co_mtx_unlock(&mutex); else co_rwlock_unlock(&rwlock);
+        }
+    }
+    atomic_fetch_add(&result, sum);
+
+    unsigned long old = atomic_fetch_sub(&done, 1);
+    if (old == 1) co_break();
+}
+
+int main(int argc, char *argv[]) {
+    char *kind = argc > 1 ? argv[1] : "rwlock";
+    unsigned long cocount = argc > 2 ? atol(argv[2]) : 8;
+    count = COUNT / cocount;
+    atomic_init(&done, cocount);
+
+    co_init(co_procs());
+
+    if (strcmp(kind, "mutex") == 0) {
+        use_mutex = 1;
+        co_mtx_init(&mutex);
+    } else if (strcmp(kind, "rwlock-reader") == 0) {
+        co_rwlock_init(&rwlock, CO_RWLOCK_PREFER_READER);
+    } else {
+        kind = "rwlock";
+        co_rwlock_init(&rwlock, CO_RWLOCK_PREFER_WRITER);
+    }
+
+    for (unsigned long i = 0; i < cocount; i++) {
+        co_spawn(locktask);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    co_run();
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+
+    unsigned long long duration =
+        (stop.tv_sec * 1000 + stop.tv_nsec / 1000000) -
+        (start.tv_sec * 1000 + start.tv_nsec / 1000000);
+
+    // should never happen:
+    if (duration == 0) duration = 1;
+
+    unsigned long writes = 0;
+    for (int i = 0; i < SIZE; i++) writes += table[i];
+
+    printf("rwlock[%d/%lu]: %s: %llu locks in %lld ms, %lld locks per second (writes=%lu)\n",
+            co_nprocs(), cocount, kind, COUNT, duration, ((1000LL * COUNT) / duration), writes);
+
+    if (!use_mutex) co_rwlock_destroy(&rwlock);
+    co_free();
+    return 0;
+}
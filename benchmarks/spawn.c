@@ -0,0 +1,209 @@
+#include "muco.h"
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <error.h>
+#include <time.h>
+
+// Recursive divide and conquer with work-first spawns (co_spawn_now): fib(N)
+// spawns fib(N-1) and computes fib(N-2) itself, nqueens(N) spawns a fiber for
+// every valid queen of the next row. Subproblems below CUTOFF are computed
+// serially. A parent waits for its children with a join counter.
+
+#define FIB_CUTOFF (8)
+#define NQUEENS_CUTOFF (5)
+#define MAX_QUEENS (16)
+
+typedef struct {
+    atomic_int pending; // children + 1 (the parent)
+    fiber_t *waiter;
+} join_t;
+
+static void join_init(join_t *join) {
+    atomic_init(&join->pending, 1);
+    join->waiter = NULL;
+}
+
+static void join_done(join_t *join) {
+    if (atomic_fetch_sub(&join->pending, 1) == 1) {
+        co_enqueue(join->waiter);
+    }
+}
+
+static void join_publish(void *data) {
+    join_t *join = data;
+    // the waiter is set before the parent releases its own count, so the last
+    // child always sees it:
+    if (atomic_fetch_sub(&join->pending, 1) == 1) {
+        co_enqueue(join->waiter);
+    }
+}
+
+static void join_wait(join_t *join) {
+    if (atomic_load(&join->pending) == 1) return;
+
+    join->waiter = co_current();
+    co_suspend_then(join_publish, join);
+}
+
+// A child reads its arguments as soon as it starts, before the spawning fiber
+// can be resumed (work-first): they're handed over through the thread.
+static __thread void *handoff;
+
+static atomic_ulong total;
+static long result;
+struct timespec start, stop;
+
+// fib
+
+typedef struct {
+    int n;
+    long result;
+    join_t *join;
+} fib_frame_t;
+
+static long fib_serial(int n) {
+    return n < 2 ? n : fib_serial(n - 1) + fib_serial(n - 2);
+}
+
+static long fib(int n);
+
+static void fib_child() {
+    fib_frame_t *frame = handoff;
+    frame->result = fib(frame->n);
+    join_done(frame->join);
+}
+
+static long fib(int n) {
+    if (n < FIB_CUTOFF) return fib_serial(n);
+
+    join_t join;
+    join_init(&join);
+    fib_frame_t frame = { n - 1, 0, &join };
+
+    atomic_fetch_add(&join.pending, 1);
+    atomic_fetch_add_explicit(&total, 1, memory_order_relaxed);
+    handoff = &frame;
+    co_spawn_now(fib_child);
+
+    long y = fib(n - 2);
+    join_wait(&join);
+    return frame.result + y;
+}
+
+// nqueens
+
+typedef struct {
+    int n;
+    int row;
+    char board[MAX_QUEENS];
+    atomic_long *count;
+    join_t *join;
+} nqueens_frame_t;
+
+static int nqueens_valid(char *board, int row, int col) {
+    for (int r = 0; r < row; r++) {
+        int c = board[r];
+        if (c == col || c - col == r - row || c - col == row - r) return 0;
+    }
+    return 1;
+}
+
+static long nqueens_serial(int n, int row, char *board) {
+    if (row == n) return 1;
+
+    long count = 0;
+    for (int col = 0; col < n; col++) {
+        if (nqueens_valid(board, row, col)) {
+            board[row] = col;
+            count += nqueens_serial(n, row + 1, board);
+        }
+    }
+    return count;
+}
+
+static long nqueens(int n, int row, char *board);
+
+static void nqueens_child() {
+    nqueens_frame_t *parent = handoff;
+    char board[MAX_QUEENS];
+    memcpy(board, parent->board, parent->row + 1);
+
+    atomic_long *count = parent->count;
+    join_t *join = parent->join;
+    int n = parent->n, row = parent->row + 1;
+
+    atomic_fetch_add(count, nqueens(n, row, board));
+    join_done(join);
+}
+
+static long nqueens(int n, int row, char *board) {
+    if (row == n) return 1;
+    if (row >= NQUEENS_CUTOFF) return nqueens_serial(n, row, board);
+
+    join_t join;
+    join_init(&join);
+    atomic_long count;
+    atomic_init(&count, 0);
+
+    nqueens_frame_t frame = { n, row, {0}, &count, &join };
+    memcpy(frame.board, board, row);
+
+    for (int col = 0; col < n; col++) {
+        if (nqueens_valid(board, row, col)) {
+            frame.board[row] = col;
+            atomic_fetch_add(&join.pending, 1);
+            atomic_fetch_add_explicit(&total, 1, memory_order_relaxed);
+            handoff = &frame;
+            co_spawn_now(nqueens_child);
+        }
+    }
+
+    join_wait(&join);
+    return atomic_load(&count);
+}
+
+static char *kind;
+static int size;
+
+static void root() {
+    if (strcmp(kind, "nqueens") == 0) {
+        char board[MAX_QUEENS];
+        result = nqueens(size, 0, board);
+    } else {
+        result = fib(size);
+    }
+    co_break();
+}
+
+int main(int argc, char *argv[]) {
+    kind = argc > 1 ? argv[1] : "fib";
+    int nqueens = strcmp(kind, "nqueens") == 0;
+    size = argc > 2 ? atoi(argv[2]) : (nqueens ? 12 : 35);
+    if (nqueens && size > MAX_QUEENS) size = MAX_QUEENS;
+
+    atomic_init(&total, 0);
+    co_init(co_procs());
+    co_spawn(root);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    co_run();
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+
+    unsigned long long duration =
+        (stop.tv_sec * 1000 + stop.tv_nsec / 1000000) -
+        (start.tv_sec * 1000 + start.tv_nsec / 1000000);
+
+    // should never happen:
+    if (duration == 0) duration = 1;
+
+    unsigned long spawned = atomic_load(&total);
+    printf("spawn[%d/%d]: %s: %lu fibers in %lld ms, %lld fibers per second (result=%ld, migrations=%lu)\n",
+            co_nprocs(), size, kind, spawned, duration, ((1000LL * spawned) / duration),
+            result, co_migrations());
+
+    co_free();
+    return 0;
+}
@@ -0,0 +1,149 @@
+#include "spin.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define COUNT (1000000ULL)
+
+// Compares the internal spin lock variants with a growing number of threads,
+// each thread locking then unlocking the same lock in a loop, around a tiny
+// critical section (as in the parking lot buckets).
+//
+// Usage: spin [max threads]
+
+// MCS queue lock, from "Algorithms for Scalable Synchronization on
+// Shared-Memory Multiprocessors" (1991): each waiting thread spins on its own
+// node (on its own stack) and the lock is handed over in FIFO order, so
+// releasing the lock only touches the next waiter's cache line.
+typedef struct mcs_node {
+    _Atomic(struct mcs_node *) next;
+    atomic_int locked;
+} mcs_node_t;
+
+typedef struct {
+    _Atomic(mcs_node_t *) tail;
+} mcs_lock_t;
+
+static inline void mcs_lock(mcs_lock_t *lock, mcs_node_t *node) {
+    atomic_store_explicit(&node->next, NULL, memory_order_relaxed);
+    atomic_store_explicit(&node->locked, 1, memory_order_relaxed);
+
+    // fast path (no previous holder):
+    mcs_node_t *prev = atomic_exchange_explicit(&lock->tail, node, memory_order_acq_rel);
+    if (!prev) return;
+
+    // link behind previous holder, then wait for it to hand the lock over:
+    atomic_store_explicit(&prev->next, node, memory_order_release);
+
+    int count = SPIN_LOCK_THRESHOLD;
+    while (atomic_load_explicit(&node->locked, memory_order_acquire)) {
+        if (count) {
+            count--;
+            spin_pause();
+        } else {
+            sched_yield();
+        }
+    }
+}
+
+static inline void mcs_unlock(mcs_lock_t *lock, mcs_node_t *node) {
+    mcs_node_t *next = atomic_load_explicit(&node->next, memory_order_acquire);
+
+    if (!next) {
+        // no waiter: release the lock:
+        mcs_node_t *expected = node;
+        if (atomic_compare_exchange_strong_explicit(&lock->tail, &expected, NULL,
+                    memory_order_release, memory_order_relaxed)) {
+            return;
+        }
+
+        // a waiter is linking itself (its thread may have been preempted):
+        int count = SPIN_LOCK_THRESHOLD;
+        while (!(next = atomic_load_explicit(&node->next, memory_order_acquire))) {
+            if (count) {
+                count--;
+                spin_pause();
+            } else {
+                sched_yield();
+            }
+        }
+    }
+
+    // hand the lock over:
+    atomic_store_explicit(&next->locked, 0, memory_order_release);
+}
+
+enum { TAS, TTAS, MCS, VARIANTS };
+static const char *names[VARIANTS] = { "tas", "ttas", "mcs" };
+
+static atomic_flag flag = ATOMIC_FLAG_INIT;
+static spin_t spin = SPIN_INITIALIZER;
+static mcs_lock_t mcs;
+
+static int variant;
+static long count;
+static volatile unsigned long counter;
+
+static void *locktask(void *data) {
+    (void)data;
+    mcs_node_t node;
+
+    for (long i = 0; i < count; i++) {
+        switch (variant) {
+        case TAS:
+            spin_lock_flag(&flag);
+            counter++;
+            spin_unlock_flag(&flag);
+            break;
+        case TTAS:
+            spin_lock(&spin);
+            counter++;
+            spin_unlock(&spin);
+            break;
+        case MCS:
+            mcs_lock(&mcs, &node);
+            counter++;
+            mcs_unlock(&mcs, &node);
+            break;
+        }
+    }
+    return NULL;
+}
+
+int main(int argc, char *argv[]) {
+    int max = argc > 1 ? atoi(argv[1]) : 8;
+    pthread_t *threads = calloc(max, sizeof(pthread_t));
+    atomic_init(&mcs.tail, NULL);
+
+    for (int n = 1; n <= max; n *= 2) {
+        for (variant = 0; variant < VARIANTS; variant++) {
+            struct timespec start, stop;
+            count = COUNT / n;
+            counter = 0;
+
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            for (int i = 0; i < n; i++) {
+                pthread_create(&threads[i], NULL, locktask, NULL);
+            }
+            for (int i = 0; i < n; i++) {
+                pthread_join(threads[i], NULL);
+            }
+            clock_gettime(CLOCK_MONOTONIC, &stop);
+
+            unsigned long long duration =
+                (stop.tv_sec * 1000 + stop.tv_nsec / 1000000) -
+                (start.tv_sec * 1000 + start.tv_nsec / 1000000);
+
+            // should never happen:
+            if (duration == 0) duration = 1;
+
+            printf("spin[%d]: %s: %llu locks in %lld ms, %lld locks per second (counter=%lu)\n",
+                    n, names[variant], COUNT, duration, ((1000LL * COUNT) / duration), counter);
+        }
+    }
+
+    free(threads);
+    return 0;
+}
@@ -0,0 +1,96 @@
+#include "muco.h"
+#include "muco/channel.h"
+#include "muco/spsc.h"
+#include <error.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define COUNT (10000000ULL)
+
+// Compares the throughput of a single producer / single consumer pair over the
+// general (buffered, asynchronous) channel and over the SPSC channel.
+//
+// Usage: spsc [chan|spsc] [capacity]
+
+struct timespec start, stop;
+static size_t capacity = 1024;
+
+static co_chan_t chan;
+static co_spsc_t spsc;
+
+static void chan_generate() {
+    long i = COUNT;
+
+    while (i--) {
+        if (co_chan_send(&chan, (void *)i)) {
+            error(1, 0, "chan is closed");
+        }
+    }
+    co_chan_close(&chan);
+}
+
+static void chan_consume() {
+    long i;
+    while (!co_chan_receive(&chan, (void *)&i));
+    co_break();
+}
+
+static void spsc_generate() {
+    long i = COUNT;
+
+    while (i--) {
+        if (co_spsc_send(&spsc, (void *)i)) {
+            error(1, 0, "spsc is closed");
+        }
+    }
+    co_spsc_close(&spsc);
+}
+
+static void spsc_consume() {
+    long i;
+    while (!co_spsc_receive(&spsc, (void *)&i));
+    co_break();
+}
+
+int main(int argc, char **argv) {
+    char *kind = argc > 1 ? argv[1] : "spsc";
+    if (argc > 2) capacity = atol(argv[2]);
+
+    co_init(co_procs());
+
+    if (strcmp(kind, "chan") == 0) {
+        co_chan_init(&chan, capacity, 1);
+        co_spawn_named(chan_generate, "gen");
+        co_spawn_named(chan_consume, "con");
+    } else {
+        kind = "spsc";
+        co_spsc_init(&spsc, capacity);
+        co_spawn_named(spsc_generate, "gen");
+        co_spawn_named(spsc_consume, "con");
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    co_run();
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+
+    unsigned long long duration =
+        (stop.tv_sec * 1000 + stop.tv_nsec / 1000000) -
+        (start.tv_sec * 1000 + start.tv_nsec / 1000000);
+
+    // should never happen:
+    if (duration == 0) duration = 1;
+
+    printf("spsc[%d/%zu]: %s: %llu messages in %lld ms, %lld messages per second\n",
+            co_nprocs(), capacity, kind, COUNT, duration, ((1000LL * COUNT) / duration));
+
+    if (kind[0] == 'c') {
+        co_chan_destroy(&chan);
+    } else {
+        co_spsc_destroy(&spsc);
+    }
+    co_free();
+
+    return 0;
+}
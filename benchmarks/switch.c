@@ -2,12 +2,14 @@
 #include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include <unistd.h>
 
 #define COUNT (10000000ULL)
 
 atomic_ulong done;
+atomic_long remaining;
 long count;
 unsigned long cocount;
 struct timespec start, stop;
@@ -25,15 +27,33 @@ static void switchtask() {
     }
 }
 
+// each fiber spawns the next fiber of its chain then exits, so the scheduler
+// switches from exiting fibers to spawned fibers:
+static void spawntask() {
+    if (atomic_fetch_sub(&remaining, 1) > 0) {
+        co_spawn(spawntask);
+        return;
+    }
+
+    unsigned long old = atomic_fetch_sub(&done, 1);
+    if (old == 1) {
+        co_break();
+    }
+}
+
 int main(int argc, char *argv[]) {
     unsigned long cocount = argc > 1 ? atol(argv[1]) : 2;
+    char *kind = argc > 2 ? argv[2] : "yield";
+    int spawn = strcmp(kind, "spawn") == 0;
+
     count = COUNT / cocount;
     atomic_init(&done, cocount);
+    atomic_init(&remaining, COUNT);
 
     co_init(co_procs());
 
     for (unsigned long i = 0; i < cocount; i++) {
-        co_spawn(switchtask);
+        co_spawn(spawn ? spawntask : switchtask);
     }
 
     clock_gettime(CLOCK_MONOTONIC, &start);
@@ -47,8 +67,9 @@ int main(int argc, char *argv[]) {
     // should never happen:
     if (duration == 0) duration = 1;
 
-    printf("switch[%d/%lu]: muco: %llu yields in %lld ms, %lld yields per second\n",
-            co_nprocs, cocount, COUNT, duration, ((1000LL * COUNT) / duration));
+    printf("switch[%d/%lu]: muco: %llu %ss in %lld ms, %lld %ss per second (switches=%lu)\n",
+            co_nprocs(), cocount, COUNT, kind, duration, ((1000LL * COUNT) / duration), kind,
+            co_switches());
     co_free();
 
     return 0;
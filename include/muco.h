@@ -2,26 +2,143 @@
 #define MUCO_H
 
 #include <signal.h>
+#include <stddef.h>
 #include "muco/fiber.h"
 #include "muco/scheduler.h"
 
-int co_nprocs;
+// Active schedulers of the current runtime (see co_set_procs), and allocated
+// schedulers. These used to be the `co_nprocs` and `co_maxprocs` global
+// variables: they're functions now that each runtime has its own schedulers
+// (see co_runtime_nprocs).
+int co_nprocs();
+int co_maxprocs();
 int co_procs();
 
+#define CO_PROCS_AUTO (-1)
+int co_set_procs(int);
+unsigned long co_switches();
+unsigned long co_migrations();
+
 void co_init(int);
 void co_free();
 void co_run();
 void co_break();
 
+// Embedding: instead of taking over the thread with co_run, a host event loop
+// runs the ready fibers of the thread's scheduler from time to time, for
+// example with co_init(0). co_run_once resumes up to `budget` fibers (0: no
+// limit), co_run_for runs fibers for up to `usec` microseconds, and co_poll
+// only runs the fibers that are ready on entry. They return the number of
+// resumed fibers, once the budget is spent or no fiber is ready anymore.
+int co_run_once(int budget);
+int co_run_for(long usec);
+int co_poll();
+
+// File descriptor that becomes readable when fibers are ready to run on the
+// thread's scheduler (eventfd), for the host loop to poll along with its own
+// file descriptors. It's reset by the next co_run_once, co_run_for or co_poll.
+int co_event_fd();
+
 fiber_t *co_spawn(fiber_main_t);
 fiber_t *co_spawn_named(fiber_main_t, char *);
+fiber_t *co_spawn_priority(fiber_main_t, co_priority_t);
+void co_set_priority(co_priority_t);
+
+// Spawns a fiber that runs immediately (work-first), with the priority of the
+// current fiber, while the current fiber is enqueued and may be stolen by
+// another thread. The child fiber may already have exited when the current
+// fiber is resumed. Spawned from the main fiber, it's merely enqueued.
+void co_spawn_now(fiber_main_t);
+
+// Where woken fibers are enqueued: on the scheduler of the waker, or back on
+// the scheduler that last resumed them (home). Pinned fibers never leave the
+// scheduler they were pinned to.
+typedef enum {
+    CO_WAKE_LOCAL = 0,
+    CO_WAKE_HOME,
+} co_wake_policy_t;
 
-scheduler_t *co_scheduler();
-fiber_t *co_current();
+void co_set_wake_policy(co_wake_policy_t);
+void co_pin();
+void co_unpin();
+
+// Independent runtimes, each with its own schedulers (threads), queues and
+// parking state. co_init, co_run, co_break, ... act on a default runtime
+// (the runtime of the current thread, once started).
+typedef struct co_runtime co_runtime_t;
+
+co_runtime_t *co_runtime();
+co_runtime_t *co_runtime_new(int);
+void co_runtime_free(co_runtime_t *);
+void co_runtime_start(co_runtime_t *);
+void co_runtime_wait(co_runtime_t *);
+void co_runtime_run(co_runtime_t *);
+void co_runtime_break(co_runtime_t *);
+fiber_t *co_runtime_spawn(co_runtime_t *, fiber_main_t);
+int co_runtime_set_procs(co_runtime_t *, int);
+int co_runtime_nprocs(co_runtime_t *);
+int co_runtime_maxprocs(co_runtime_t *);
+
+int co_scheduler_id();
 fiber_t *co_main();
 
+// Approximate number of fibers in the local queue of the current scheduler,
+// at the priority of the current fiber (i.e. that thieves may steal).
+int co_queue_size();
+
+// Current fiber of the current thread. Never take its address: a fiber may be
+// resumed by another thread, while compilers assume that the thread pointer
+// doesn't change within a function.
+extern __thread fiber_t *co_tl_current __attribute__((tls_model("initial-exec")));
+
+static inline fiber_t *co_current() {
+    return co_tl_current;
+}
+
+// Scheduler of the current thread (NULL for a thread that runs no scheduler).
+// Same as co_tl_current: never take its address.
+extern __thread scheduler_t *co_tl_scheduler __attribute__((tls_model("initial-exec")));
+
+static inline scheduler_t *co_scheduler() {
+    return co_tl_scheduler;
+}
+
+// Fiber-local storage: values follow the fiber when it migrates between
+// threads. Keys are allocated once per process (up to CO_FLS_SLOTS, returns
+// EAGAIN once exhausted) and are never released. When a fiber exits, the
+// destructor of each key (if any) is called with the fiber's value, if set,
+// and the slots are cleared before the fiber is recycled.
+int co_fls_key_create(co_fls_key_t *, co_fls_destructor_t);
+
+static inline void *co_fls_get(co_fls_key_t key) {
+    return co_tl_current->fls[key];
+}
+
+static inline void co_fls_set(co_fls_key_t key, void *value) {
+    co_tl_current->fls[key] = value;
+}
+
+// Fiber arena: allocates memory (aligned to 16 bytes) that is released at once
+// when the current fiber exits, so it must never be freed, nor referenced by
+// other fibers after the fiber exited. Chunks come from a cache of the
+// scheduler, without locking. Memory allocated by the main fiber is only
+// released by co_free.
+void *co_arena_alloc(size_t size);
+
+// Enqueues a suspended fiber. May be called from any thread: a thread that
+// runs no scheduler injects the fiber into its home scheduler.
 void co_enqueue(fiber_t *);
+void co_enqueue_list(fiber_t *);
+void co_enqueue_next(fiber_t *);
 void co_suspend();
+
+// Suspends the current fiber, then runs `action(data)` once the fiber has been
+// switched out, which is where a fiber may publish itself (e.g. add itself to
+// a wait list) so it can't be resumed before its context is saved. The fiber
+// may be resumed as soon as it's published: the action must copy what it
+// needs from `data` first, if it lives on the suspended fiber's stack.
+typedef void (*co_action_t)(void *data);
+void co_suspend_then(co_action_t, void *);
 void co_resume(fiber_t *);
 void co_yield();
 
@@ -0,0 +1,64 @@
+#ifndef MUCO_BROADCAST_H
+#define MUCO_BROADCAST_H
+
+#include "muco/fiber.h"
+#include "muco/mutex.h"
+#include <stdatomic.h>
+#include <stddef.h>
+
+#ifndef CO_CACHELINE_SIZE
+#define CO_CACHELINE_SIZE 64
+#endif
+
+// Broadcast (publish/subscribe) channel.
+//
+// Published values are stored once in a shared ring, that each subscriber
+// reads through its own cursor. The policy decides what happens when the
+// slowest subscriber is a full ring behind the publisher.
+typedef enum {
+    CO_BCAST_BLOCK = 0,   // publishers wait for the slowest subscriber
+    CO_BCAST_DROP_OLDEST, // slow subscribers silently skip overwritten values
+    CO_BCAST_LAG,         // slow subscribers get CO_BCAST_LAGGED, then skip
+} co_bcast_policy_t;
+
+#define CO_BCAST_LAGGED (-2)
+
+typedef struct co_bcast co_bcast_t;
+
+typedef struct co_bcast_sub {
+    _Alignas(CO_CACHELINE_SIZE) atomic_size_t cursor;
+    co_bcast_t *chan;
+    struct co_bcast_sub *next;
+} co_bcast_sub_t;
+
+struct co_bcast {
+    co_bcast_policy_t policy;
+    int closed;
+    int waiting;
+
+    size_t capacity;
+    size_t mask;
+    _Atomic(void *) *buf;
+
+    _Alignas(CO_CACHELINE_SIZE) atomic_size_t reserved;
+    atomic_size_t tail;
+    atomic_int blocked;
+
+    co_bcast_sub_t *subs;
+    co_mtx_t mutex;
+    co_cond_t publishers;
+    co_cond_t receivers;
+};
+
+void co_bcast_init(co_bcast_t *, size_t capacity, co_bcast_policy_t policy);
+void co_bcast_destroy(co_bcast_t *);
+// Publish and receive return -1 once the channel is closed, and ECANCELED when
+// the current fiber has been cancelled while blocked (see co_cancel).
+int co_bcast_publish(co_bcast_t *, void *);
+void co_bcast_close(co_bcast_t *);
+
+void co_bcast_subscribe(co_bcast_t *, co_bcast_sub_t *);
+void co_bcast_unsubscribe(co_bcast_sub_t *);
+int co_bcast_receive(co_bcast_sub_t *, void **);
+
+#endif
@@ -22,6 +22,8 @@ typedef struct {
     co_cond_t receivers;
 } co_chan_t;
 
+// Send and receive return -1 once the channel is closed, and ECANCELED when
+// the current fiber has been cancelled while blocked (see co_cancel).
 void co_chan_init(co_chan_t *, size_t capacity, int async);
 void co_chan_destroy(co_chan_t *);
 int co_chan_send(co_chan_t *, void *);
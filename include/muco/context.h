@@ -0,0 +1,56 @@
+#ifndef MUCO_CONTEXT_H
+#define MUCO_CONTEXT_H
+
+#include "muco/fiber.h"
+#include <stdint.h>
+
+// Jump switches, for fibers that only ever resume each other (generators).
+// co_swapcontext is a call that returns on another stack, so every switch
+// mispredicts its return; co_jumpcontext is inlined in the caller instead,
+// saves the resume address along with rbp, and jumps. The other registers
+// are clobbered, so the compiler only saves what is live across the switch.
+// The calls and returns around the switch must balance too, so the functions
+// switching (co_gen_next and co_gen_yield) are inlined as well.
+//
+// A fiber suspended by co_jumpcontext must be resumed by co_jumpcontext, and
+// a fresh fiber must first be prepared with fiber_jump_makecontext.
+
+#if defined(__x86_64__)
+
+// pops the registers pushed by fiber_makecontext, then resumes fiber_run
+// (defined along with the scheduler, see context/x86_64.h):
+void co_jump_enter(void);
+
+static inline void fiber_jump_makecontext(fiber_t *self) {
+    uintptr_t *sp = (uintptr_t *)self->stack_top - 2;
+    sp[0] = (uintptr_t)co_jump_enter;                 // RIP (resume address)
+    sp[1] = 0;                                        // RBP
+    self->stack_top = sp;
+}
+
+static inline __attribute__((always_inline)) void *co_jumpcontext(fiber_t *curr, fiber_t *next, void *data) {
+    __asm__ volatile (
+        "leaq -128(%%rsp), %%rsp\n\t"  // skip the red zone
+        "leaq 1f(%%rip), %%rcx\n\t"
+        "pushq %%rbp\n\t"
+        "pushq %%rcx\n\t"              // push resume address
+        "movq %%rsp, 0(%[curr])\n\t"   // curr->stack_top = rsp
+        "movq 0(%[next]), %%rsp\n\t"   // rsp = next->stack_top
+        "popq %%rcx\n\t"
+        "popq %%rbp\n\t"
+        "jmpq *%%rcx\n"
+        "1:\n\t"
+        "leaq 128(%%rsp), %%rsp\n\t"
+        : "+a" (data), [curr] "+D" (curr), [next] "+S" (next)
+        :
+        : "rbx", "rcx", "rdx", "r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15",
+          "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5", "xmm6", "xmm7",
+          "xmm8", "xmm9", "xmm10", "xmm11", "xmm12", "xmm13", "xmm14", "xmm15",
+          "memory", "cc"
+    );
+    return data;
+}
+
+#endif
+
+#endif
@@ -5,12 +5,33 @@
 #include <stdint.h>
 
 typedef struct fiber fiber_t;
+struct scheduler;
+struct co_nursery;
+struct co_cancel;
+struct co_gen;
 typedef void (*fiber_main_t)();
 typedef void (*fiber_exit_t)(fiber_t *);
 typedef void (*fiber_run_t)(fiber_t *);
 
+// Runnable fibers of higher priority run first. Lower priorities age so they
+// aren't starved.
+typedef enum {
+    CO_PRIORITY_HIGH = 0,
+    CO_PRIORITY_NORMAL,
+    CO_PRIORITY_BACKGROUND,
+} co_priority_t;
+
+#define CO_PRIORITY_LEVELS 3
+
+// Number of fiber-local storage keys (see co_fls_key_create).
+#define CO_FLS_SLOTS 16
+
+typedef unsigned int co_fls_key_t;
+typedef void (*co_fls_destructor_t)(void *);
+
+// mirrors the private definition (src/fiber.h), that the library uses instead:
+#ifndef MUCO_FIBER_PRIV_H
 typedef struct fiber {
-    long resumeable; // don't move: required by context asm
     void *stack_top; // don't move: required by context asm
     stack_t stack;
 
@@ -18,9 +39,27 @@ typedef struct fiber {
     fiber_exit_t link;
 
     fiber_t *m_next;
+    int priority;
+
+    struct scheduler *home; // last scheduler that resumed the fiber
+    int pinned;             // never migrates from home
+
+    fiber_t *peer;          // last fiber that woke this fiber up
+    int coupling;           // consecutive wakeups by peer
+
+    struct co_nursery *nursery;       // waits for the fiber (if any)
+    struct co_cancel *cancel;         // cancellation token (if any)
+    _Atomic unsigned long generation; // incremented on exit (see co_join)
+    _Atomic int joiners;              // fibers are parked on the fiber
+    _Atomic int handles;              // outstanding join handles
+
+    void *fls[CO_FLS_SLOTS];          // fiber-local storage
+    struct arena_chunk *arena;        // chunks of co_arena_alloc
+    struct co_gen *gen;               // generator run by the fiber (if any)
 
     char *name;
 } fiber_t;
+#endif
 
 fiber_t *co_fiber_new(fiber_main_t);
 void co_fiber_free(fiber_t *);
@@ -0,0 +1,47 @@
+#ifndef MUCO_FUTURE_H
+#define MUCO_FUTURE_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+// One-shot future, completed by a promise from any thread, including threads
+// that don't run a scheduler (e.g. the callback thread of an I/O library).
+//
+// The future is a single atomic word: empty, set, or a pointer to the record
+// of the fiber waiting on it. Setting the promise is lock-free: it either
+// marks the future as set, or claims the waiter record and enqueues the fiber
+// (injecting it into its home scheduler and unparking its thread when the
+// promise is set from a foreign thread). Unparking is a single atomic exchange
+// of the parked state of the scheduler, followed by a futex wake only if the
+// thread was actually sleeping.
+//
+// A future may only be awaited by one fiber at a time, and a promise must be
+// set only once (co_future_init resets a future). Futures aren't blocking
+// points of the parking lot, so waiting for a future isn't cancellable: the
+// waiting fiber must not have a cancellation token (see co_set_cancel), which
+// debug builds check.
+typedef struct {
+    _Atomic uintptr_t state;
+    void *value;
+} co_future_t;
+
+void co_future_init(co_future_t *);
+
+// Completes the future with `value`, waking up the waiting fiber (if any).
+void co_promise_set(co_future_t *, void *value);
+
+// Whether the promise has been set.
+int co_future_ready(co_future_t *);
+
+// Suspends the current fiber until the promise is set, then returns its value.
+void *co_future_wait(co_future_t *);
+
+// Suspends the current fiber until any of the futures is set, and returns the
+// index of the first future set in the array (-1 when `count` is zero).
+int co_future_wait_any(co_future_t **, int count);
+
+// Suspends the current fiber until all the futures are set. The fiber is
+// only resumed once, by the last promise.
+void co_future_wait_all(co_future_t **, int count);
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef MUCO_GENERATOR_H
+#define MUCO_GENERATOR_H
+
+#include "muco.h"
+#include "muco/context.h"
+
+typedef void (*co_gen_fn_t)(void *arg);
+
+// Generator: co_gen_next switches to the generator's fiber, that runs until
+// it calls co_gen_yield, which switches straight back with the value. The
+// switches are symmetric: they bypass the scheduler (no queue, no atomic),
+// so the generator must only suspend through co_gen_yield (it mustn't block
+// or yield). The generator is resumed on the thread of the fiber calling
+// co_gen_next, and may itself iterate other generators.
+typedef struct co_gen {
+    fiber_t *fiber;
+    fiber_t *caller;
+    scheduler_t *scheduler;      // of the caller, while the generator runs
+    co_gen_fn_t proc;
+    void *arg;
+    int done;
+} co_gen_t;
+
+void co_gen_init(co_gen_t *, co_gen_fn_t, void *arg);
+
+// Releases the generator's fiber. The generator may not have returned, but
+// its stack is discarded without being unwound.
+void co_gen_destroy(co_gen_t *);
+
+// Switches between a generator and the fiber iterating it, without going
+// through the scheduler, passing `data` along (see muco/context.h).
+static inline __attribute__((always_inline)) void *co_gen_switch(co_gen_t *gen, fiber_t *from, fiber_t *to, void *data) {
+    gen->scheduler->current = to;
+    co_tl_current = to;
+    return co_jumpcontext(from, to, data);
+}
+
+// Resumes the generator until it yields a value, or returns. Returns 0 and
+// sets `value`, or -1 once the generator returned.
+static inline int co_gen_next(co_gen_t *gen, void **value) {
+    if (gen->done) return -1;
+
+    // generators may iterate generators (each generator knows its caller):
+    gen->caller = co_tl_current;
+    gen->scheduler = co_scheduler();
+    gen->fiber->home = gen->caller->home;
+
+    void *data = co_gen_switch(gen, gen->caller, gen->fiber, NULL);
+
+    if (gen->done) return -1;
+    *value = data;
+    return 0;
+}
+
+// Suspends the current generator, passing `value` to co_gen_next.
+static inline void co_gen_yield(void *value) {
+    co_gen_t *gen = co_tl_current->gen;
+    co_gen_switch(gen, gen->fiber, gen->caller, value);
+}
+
+#endif
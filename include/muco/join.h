@@ -0,0 +1,69 @@
+#ifndef MUCO_JOIN_H
+#define MUCO_JOIN_H
+
+#include "muco/sync.h"
+
+// only declares the fiber types (the header is shared with the scheduler):
+typedef struct fiber fiber_t;
+typedef void (*fiber_main_t)();
+
+// Cancellation token. Fibers inherit the token of the fiber that spawned
+// them, and a token created by a fiber is a child of the fiber's token, so
+// cancelling a token cancels a whole subtree of fibers. Cancelled fibers can't
+// block anymore: fibers blocked on a mutex, condition variable, semaphore,
+// latch, wait group, read-write lock, join, channel or SPSC channel (the
+// blocking points over the parking lot) are woken up and return ECANCELED,
+// and so does any subsequent attempt to block. Waiting for a future isn't
+// cancellable (see muco/future.h). A token must outlive the fibers that use
+// it.
+typedef struct co_cancel {
+    atomic_int cancelled;
+    struct co_cancel *parent;
+} co_cancel_t;
+
+void co_cancel_init(co_cancel_t *);
+void co_cancel(co_cancel_t *);
+int co_cancel_requested(co_cancel_t *);
+
+// Sets the token of the current fiber (NULL: not cancellable) and returns the
+// previous one.
+co_cancel_t *co_set_cancel(co_cancel_t *);
+
+// Whether the token of the current fiber (or any parent token) has been
+// cancelled.
+int co_cancelled();
+
+// Join handle: the fiber may be recycled once it exited, so the handle
+// remembers its generation. co_join suspends the current fiber until the
+// fiber exited (or returns immediately). Every handle must be joined or
+// detached once, otherwise the fiber is never freed (only recycled).
+// Returns ECANCELED if the current fiber has been cancelled.
+typedef struct {
+    fiber_t *fiber;
+    unsigned long generation;
+} co_handle_t;
+
+co_handle_t co_spawn_handle(fiber_main_t);
+int co_join(co_handle_t);
+void co_detach(co_handle_t);
+
+// Structured concurrency: a nursery (scope) spawns child fibers and waits for
+// all of them before it goes out of scope. Children use the nursery's token,
+// so cancelling a nursery cancels its children, and the nurseries they
+// created in turn. Children check co_cancelled() and return early, and are
+// woken up if they're blocked.
+typedef struct co_nursery {
+    co_waitgroup_t group;
+    co_cancel_t cancel;
+} co_nursery_t;
+
+void co_nursery_init(co_nursery_t *);
+void co_nursery_spawn(co_nursery_t *, fiber_main_t);
+void co_nursery_cancel(co_nursery_t *);
+int co_nursery_cancelled(co_nursery_t *);
+
+// Waits for all the children of the nursery to return, even if the current
+// fiber has been cancelled.
+void co_nursery_wait(co_nursery_t *);
+
+#endif
@@ -3,24 +3,29 @@
 
 #include <stdatomic.h>
 
+// Mutexes and condition variables are a single word. Blocked fibers are
+// parked in a global table of wait queues, hashed by address. A cancelled
+// fiber (see co_cancel) can't block: co_mtx_lock returns ECANCELED without
+// the lock, co_cond_wait returns ECANCELED with the mutex locked again.
+// Cleanup paths use co_mtx_lock_nocancel, that always takes the lock.
 typedef struct {
-    atomic_int held;
-    atomic_flag busy;
-    struct { fiber_t *head, *tail; } blocking;
+    atomic_uint state;
 } co_mtx_t;
 
+// A condition variable remembers the mutex its waiters use (if any), so it
+// can move them to the mutex's wait queue when signaled.
 typedef struct {
-    atomic_flag busy;
-    struct { fiber_t *head, *tail; } waiting;
+    _Atomic(co_mtx_t *) mutex;
 } co_cond_t;
 
 void co_mtx_init(co_mtx_t *);
 int co_mtx_lock(co_mtx_t *);
+void co_mtx_lock_nocancel(co_mtx_t *);
 int co_mtx_trylock(co_mtx_t *);
 void co_mtx_unlock(co_mtx_t *);
 
 void co_cond_init(co_cond_t *);
-void co_cond_wait(co_cond_t *, co_mtx_t *);
+int co_cond_wait(co_cond_t *, co_mtx_t *);
 void co_cond_signal(co_cond_t *);
 void co_cond_broadcast(co_cond_t *);
 
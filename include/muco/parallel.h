@@ -0,0 +1,35 @@
+#ifndef MUCO_PARALLEL_H
+#define MUCO_PARALLEL_H
+
+#include <stddef.h>
+
+// Data-parallel loops over [begin, end).
+//
+// Ranges are split lazily: a fiber processes `grain` iterations at a time and
+// only forks the second half of its remaining range (work-first) when its
+// scheduler's queue is empty, that is when thieves would otherwise have
+// nothing to steal. With a single scheduler, or when every thread is busy,
+// the loop thus runs with almost no overhead. Callers wait for the whole loop
+// to complete, suspending their fiber (not the thread) if needed. Must be
+// called from a fiber; from the main fiber the loop runs serially.
+
+// Processes the iterations in [begin, end).
+typedef void (*co_parallel_fn_t)(size_t begin, size_t end, void *ctx);
+
+// Accumulates the iterations in [begin, end) into `acc`.
+typedef void (*co_reduce_fn_t)(size_t begin, size_t end, void *acc, void *ctx);
+
+// Combines `other` into `acc`, where `other` accumulated iterations that come
+// right after the iterations of `acc`.
+typedef void (*co_combine_fn_t)(void *acc, const void *other, void *ctx);
+
+void co_parallel_for(size_t begin, size_t end, size_t grain, co_parallel_fn_t fn, void *ctx);
+
+// Reduces [begin, end) into `acc`, an accumulator of `size` bytes that must be
+// initialized with `identity` by the caller. Forked ranges accumulate into
+// their own copy of `identity`, and are combined in order.
+void co_parallel_reduce(size_t begin, size_t end, size_t grain,
+        void *acc, size_t size, const void *identity,
+        co_reduce_fn_t fn, co_combine_fn_t combine, void *ctx);
+
+#endif
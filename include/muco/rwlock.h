@@ -0,0 +1,49 @@
+#ifndef MUCO_RWLOCK_H
+#define MUCO_RWLOCK_H
+
+#include "muco/fiber.h"
+#include "muco/mutex.h"
+#include <stdatomic.h>
+
+#ifndef CO_CACHELINE_SIZE
+#define CO_CACHELINE_SIZE 64
+#endif
+
+// Reader-writer lock.
+//
+// Readers only increment (then decrement) a counter local to their scheduler,
+// so parallel readers don't bounce a shared cache line. Writers are
+// serialized, then wait for the sum of all counters to drop to zero.
+//
+// There is one counter per scheduler, as returned by co_maxprocs() when the
+// lock is initialized, so co_rwlock_init must be called after co_init (or
+// from a fiber of the runtime using the lock). A lock initialized before has
+// a single counter: it's still correct, but all readers then share (and
+// bounce) its cache line.
+typedef enum {
+    CO_RWLOCK_PREFER_WRITER = 0, // new readers wait while a writer is waiting
+    CO_RWLOCK_PREFER_READER,     // writers wait until there are no readers
+} co_rwlock_kind_t;
+
+typedef struct {
+    _Alignas(CO_CACHELINE_SIZE) atomic_long count;
+} co_rwlock_slot_t;
+
+typedef struct {
+    atomic_uint state;
+    co_rwlock_kind_t kind;
+    _Atomic(fiber_t *) owner;
+    int nslots;
+    co_rwlock_slot_t *readers;
+    co_mtx_t writer;
+} co_rwlock_t;
+
+void co_rwlock_init(co_rwlock_t *, co_rwlock_kind_t);
+void co_rwlock_destroy(co_rwlock_t *);
+int co_rwlock_rdlock(co_rwlock_t *);
+int co_rwlock_tryrdlock(co_rwlock_t *);
+int co_rwlock_wrlock(co_rwlock_t *);
+int co_rwlock_trywrlock(co_rwlock_t *);
+void co_rwlock_unlock(co_rwlock_t *);
+
+#endif
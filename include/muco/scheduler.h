@@ -2,8 +2,12 @@
 #define MUCO_SCHEDULER_H
 
 #include "muco/fiber.h"
+#include <pthread.h>
 #include <stdint.h>
 
+// mirrors the private definition (src/scheduler.h), that the library uses
+// instead:
+#ifndef MUCO_SCHEDULER_PRIV_H
 struct scheduler_queue {
     _Atomic int bot;
     _Atomic struct {
@@ -14,17 +18,45 @@ struct scheduler_queue {
 
 typedef struct scheduler {
     int color;
+    struct co_runtime *runtime;
 
     fiber_t *main;
     fiber_t *current;
+    fiber_t *next;
+    fiber_t *coupled;
 
-    struct scheduler_queue runnables;
+    struct scheduler_queue runnables[CO_PRIORITY_LEVELS];
+    int skipped[CO_PRIORITY_LEVELS];
     struct scheduler_queue pending;
 
+    fiber_t *injected;
+    fiber_t *pinned_head;
+    fiber_t *pinned_tail;
+
+    int parked;
+
     struct {
         uint64_t state;
         uint64_t inc;
     } rng;
+
+    void (*action)(void *);
+    void *action_data;
+    fiber_t *yielded;
+
+    int budget;
+    uint64_t deadline;
+    int eventfd;
+    int notified;
+
+    struct {
+        struct arena_chunk *head;
+        int count;
+    } arena;
+
+    unsigned long switches;
+    unsigned long migrations;
 } scheduler_t;
+#endif
 
 #endif
@@ -0,0 +1,45 @@
+#ifndef MUCO_SPSC_H
+#define MUCO_SPSC_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+#ifndef CO_CACHELINE_SIZE
+#define CO_CACHELINE_SIZE 64
+#endif
+
+// Single-producer/single-consumer channel.
+//
+// A bounded ring whose send and receive are wait-free, unless the ring is
+// full (sender) or empty (receiver), in which case the fiber is suspended
+// until its peer made some progress. Only one fiber may send, and only one
+// fiber may receive, at any given time.
+//
+// Send and receive return -1 once the channel is closed, and ECANCELED when
+// the current fiber has been cancelled (see co_cancel), in which case nothing
+// was sent or received.
+typedef struct {
+    // consumer side:
+    _Alignas(CO_CACHELINE_SIZE) atomic_size_t head;
+    size_t tail_cache;
+    atomic_int receiver;            // a receiver is parked
+
+    // producer side:
+    _Alignas(CO_CACHELINE_SIZE) atomic_size_t tail;
+    size_t head_cache;
+    atomic_int sender;              // a sender is parked
+
+    // shared (read mostly):
+    _Alignas(CO_CACHELINE_SIZE) size_t capacity;
+    size_t mask;
+    atomic_int closed;
+    void **buf;
+} co_spsc_t;
+
+void co_spsc_init(co_spsc_t *, size_t capacity);
+void co_spsc_destroy(co_spsc_t *);
+int co_spsc_send(co_spsc_t *, void *);
+int co_spsc_receive(co_spsc_t *, void **);
+void co_spsc_close(co_spsc_t *);
+
+#endif
@@ -0,0 +1,56 @@
+#ifndef MUCO_SYNC_H
+#define MUCO_SYNC_H
+
+#include <stdatomic.h>
+
+// Blocking functions return ECANCELED once the current fiber has been
+// cancelled (see co_cancel), without waiting.
+
+// Counting semaphore.
+typedef struct {
+    atomic_long value;
+    atomic_uint waiters;
+} co_sem_t;
+
+// Single-use count-down latch: fibers wait until the count drops to zero.
+typedef struct {
+    atomic_long count;
+    atomic_uint waiters;
+} co_latch_t;
+
+// Cyclic barrier: fibers wait until `count` fibers reached the barrier, which
+// is then reset for the next phase.
+typedef struct {
+    unsigned int count;
+    atomic_ulong state; // generation (high 32 bits) + arrivals (low 32 bits)
+} co_barrier_t;
+
+#define CO_BARRIER_SERIAL_FIBER (1)
+
+// Wait group: fibers wait until as many fibers are done as have been added.
+// Unlike a latch, the counter may be incremented (and reused) at any time.
+// The last co_waitgroup_done never touches the group after the count dropped
+// to zero, so a waiter may release it as soon as it returns.
+typedef struct {
+    atomic_ulong state; // count (high bits) + waiters (low bit)
+} co_waitgroup_t;
+
+void co_sem_init(co_sem_t *, long value);
+int co_sem_wait(co_sem_t *);
+int co_sem_trywait(co_sem_t *);
+void co_sem_post(co_sem_t *);
+
+void co_latch_init(co_latch_t *, long count);
+void co_latch_count_down(co_latch_t *, long n);
+int co_latch_wait(co_latch_t *);
+int co_latch_trywait(co_latch_t *);
+
+void co_barrier_init(co_barrier_t *, unsigned int count);
+int co_barrier_wait(co_barrier_t *);
+
+void co_waitgroup_init(co_waitgroup_t *);
+void co_waitgroup_add(co_waitgroup_t *, long n);
+void co_waitgroup_done(co_waitgroup_t *);
+int co_waitgroup_wait(co_waitgroup_t *);
+
+#endif
@@ -0,0 +1,78 @@
+#include "muco.h"
+#include "muco/channel.h"
+#include <error.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+// The host application keeps its own event loop (epoll) and never calls
+// co_run: it waits for the fibers' eventfd along with its own file
+// descriptors (here a timer), then runs the ready fibers for a while.
+
+static co_chan_t chan;
+static int done;
+
+void consumer() {
+    long m;
+
+    while (!co_chan_receive(&chan, (void *)&m)) {
+        printf("received: %ld\n", m);
+    }
+    done = 1;
+}
+
+void producer() {
+    for (long i = 1; i <= 3; i++) {
+        co_chan_send(&chan, (void *)i);
+    }
+    co_chan_close(&chan);
+}
+
+int main() {
+    // no scheduler threads: fibers only run from the loop below
+    co_init(0);
+    co_chan_init(&chan, 1, 0);
+
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    int evfd = co_event_fd();
+
+    int tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    struct itimerspec its = { { 0, 10000000 }, { 0, 10000000 } };
+    timerfd_settime(tfd, 0, &its, NULL);
+
+    struct epoll_event ev = { .events = EPOLLIN };
+    ev.data.fd = evfd;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, evfd, &ev);
+    ev.data.fd = tfd;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, tfd, &ev);
+
+    co_spawn(consumer);
+    co_spawn(producer);
+
+    int ticks = 0;
+
+    while (!done) {
+        struct epoll_event events[2];
+        int n = epoll_wait(epfd, events, 2, -1);
+        if (n < 0 && errno != EINTR) error(1, errno, "epoll_wait");
+
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.fd == tfd) {
+                uint64_t expirations;
+                if (read(tfd, &expirations, sizeof(expirations)) > 0) ticks++;
+            } else {
+                // run fibers for at most 1ms, then get back to the loop:
+                printf("resumed %d fibers\n", co_run_for(1000));
+            }
+        }
+    }
+    printf("ticks: %d\n", ticks);
+
+    close(tfd);
+    close(epfd);
+    co_chan_destroy(&chan);
+    co_free();
+}
@@ -0,0 +1,92 @@
+#include "muco.h"
+#include "muco/future.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Fibers submit requests to a service thread, that runs no scheduler (as the
+// callback thread of a client library would), then wait for the futures that
+// the thread completes.
+
+#define REQUESTS (8)
+
+typedef struct request {
+    long n;
+    co_future_t future;
+    struct request *next;
+} request_t;
+
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static request_t *queue;
+static int stopped;
+
+static void submit(request_t *request, long n) {
+    request->n = n;
+    co_future_init(&request->future);
+
+    pthread_mutex_lock(&mutex);
+    request->next = queue;
+    queue = request;
+    pthread_cond_signal(&cond);
+    pthread_mutex_unlock(&mutex);
+}
+
+static void *service(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&mutex);
+
+    while (!stopped) {
+        while (queue) {
+            request_t *request = queue;
+            queue = request->next;
+
+            pthread_mutex_unlock(&mutex);
+            co_promise_set(&request->future, (void *)(intptr_t)(request->n * request->n));
+            pthread_mutex_lock(&mutex);
+        }
+        pthread_cond_wait(&cond, &mutex);
+    }
+
+    pthread_mutex_unlock(&mutex);
+    return NULL;
+}
+
+static void run() {
+    request_t requests[REQUESTS];
+    co_future_t *futures[REQUESTS];
+
+    submit(&requests[0], 12);
+    printf("run: 12 * 12 = %ld\n", (long)(intptr_t)co_future_wait(&requests[0].future));
+
+    for (int i = 0; i < REQUESTS; i++) {
+        submit(&requests[i], i);
+        futures[i] = &requests[i].future;
+    }
+
+    int index = co_future_wait_any(futures, REQUESTS);
+    printf("run: request %d completed first\n", index);
+
+    co_future_wait_all(futures, REQUESTS);
+    for (int i = 0; i < REQUESTS; i++) {
+        printf("run: %d * %d = %ld\n", i, i, (long)(intptr_t)co_future_wait(futures[i]));
+    }
+
+    co_break();
+}
+
+int main() {
+    pthread_t thread;
+    pthread_create(&thread, NULL, service, NULL);
+
+    co_init(co_procs());
+    co_spawn(run);
+    co_run();
+    co_free();
+
+    pthread_mutex_lock(&mutex);
+    stopped = 1;
+    pthread_cond_signal(&cond);
+    pthread_mutex_unlock(&mutex);
+    pthread_join(thread, NULL);
+}
@@ -0,0 +1,48 @@
+#include "muco.h"
+#include "muco/join.h"
+#include <stdio.h>
+
+// A fiber joins a worker through its handle, then runs pollers in a nursery
+// that it cancels, and waits for all of them to return.
+
+static void worker() {
+    printf("worker: done\n");
+}
+
+static void poller() {
+    long polls = 0;
+
+    while (!co_cancelled()) {
+        polls++;
+        co_yield();
+    }
+    printf("poller: cancelled after %ld polls\n", polls);
+}
+
+static void canceller() {
+    co_yield();
+    co_nursery_cancel(co_current()->nursery);
+}
+
+static void run() {
+    co_handle_t handle = co_spawn_handle(worker);
+    co_join(handle);
+    printf("run: joined worker\n");
+
+    co_nursery_t nursery;
+    co_nursery_init(&nursery);
+    co_nursery_spawn(&nursery, poller);
+    co_nursery_spawn(&nursery, poller);
+    co_nursery_spawn(&nursery, canceller);
+    co_nursery_wait(&nursery);
+    printf("run: nursery is done\n");
+
+    co_break();
+}
+
+int main() {
+    co_init(co_procs());
+    co_spawn(run);
+    co_run();
+    co_free();
+}
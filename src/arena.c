@@ -0,0 +1,89 @@
+#include "muco.h"
+#include "arena.h"
+
+#include <errno.h>
+#include <error.h>
+#include <stdlib.h>
+
+static arena_chunk_t *arena_chunk_new(size_t size) {
+    arena_chunk_t *chunk = malloc(sizeof(arena_chunk_t) + size);
+    if (chunk == NULL) {
+        error(1, errno, "malloc");
+    }
+    chunk->size = size;
+    return chunk;
+}
+
+void *arena_grow(arena_chunk_t **arena, arena_cache_t *cache, size_t size) {
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    arena_chunk_t *chunk;
+
+    if (size > ARENA_CHUNK_SIZE) {
+        // oversized: keep bumping the current chunk (if any):
+        chunk = arena_chunk_new(size);
+        chunk->used = size;
+
+        if (*arena) {
+            chunk->next = (*arena)->next;
+            (*arena)->next = chunk;
+        } else {
+            chunk->next = NULL;
+            *arena = chunk;
+        }
+        return chunk->data;
+    }
+
+    if (cache->head) {
+        chunk = cache->head;
+        cache->head = chunk->next;
+        cache->count--;
+    } else {
+        chunk = arena_chunk_new(ARENA_CHUNK_SIZE);
+    }
+
+    chunk->used = size;
+    chunk->next = *arena;
+    *arena = chunk;
+    return chunk->data;
+}
+
+void arena_release(arena_chunk_t **arena, arena_cache_t *cache) {
+    arena_chunk_t *chunk = *arena;
+    *arena = NULL;
+
+    while (chunk) {
+        arena_chunk_t *next = chunk->next;
+
+        if (chunk->size == ARENA_CHUNK_SIZE && cache->count < ARENA_CACHE_SIZE) {
+            chunk->next = cache->head;
+            cache->head = chunk;
+            cache->count++;
+        } else {
+            free(chunk);
+        }
+        chunk = next;
+    }
+}
+
+void arena_free(arena_chunk_t *chunk) {
+    while (chunk) {
+        arena_chunk_t *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+}
+
+void arena_cache_finalize(arena_cache_t *cache) {
+    arena_free(cache->head);
+    arena_cache_initialize(cache);
+}
+
+void *co_arena_alloc(size_t size) {
+    fiber_t *fiber = co_tl_current;
+    void *ptr = arena_bump(fiber->arena, size);
+
+    if (!ptr) {
+        ptr = arena_grow(&fiber->arena, scheduler_arena_cache(), size);
+    }
+    return ptr;
+}
@@ -0,0 +1,57 @@
+#ifndef MUCO_ARENA_PRIV_H
+#define MUCO_ARENA_PRIV_H
+
+// Bump allocator of a fiber: allocations are never freed individually, the
+// chunks are released at once when the fiber exits. Chunks are taken from
+// and released to a cache of the scheduler running the fiber, that is only
+// accessed by the scheduler's thread, so allocating doesn't take a lock.
+// Allocations larger than a chunk get a chunk of their own, that is freed
+// rather than cached.
+
+#include "config.h"
+#include <stddef.h>
+
+#define ARENA_ALIGN (16)
+
+typedef struct arena_chunk {
+    struct arena_chunk *next;
+    size_t size; // usable bytes
+    size_t used;
+    _Alignas(ARENA_ALIGN) char data[];
+} arena_chunk_t;
+
+typedef struct {
+    arena_chunk_t *head;
+    int count;
+} arena_cache_t;
+
+static inline void arena_cache_initialize(arena_cache_t *cache) {
+    cache->head = NULL;
+    cache->count = 0;
+}
+
+// Returns NULL when the current chunk is full.
+static inline void *arena_bump(arena_chunk_t *chunk, size_t size) {
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+    if (chunk && chunk->size - chunk->used >= size) {
+        void *ptr = chunk->data + chunk->used;
+        chunk->used += size;
+        return ptr;
+    }
+    return NULL;
+}
+
+// Adds a chunk to the arena then allocates from it.
+void *arena_grow(arena_chunk_t **arena, arena_cache_t *cache, size_t size);
+
+// Releases all the chunks of the arena to the cache (or frees them).
+void arena_release(arena_chunk_t **arena, arena_cache_t *cache);
+
+void arena_free(arena_chunk_t *chunk);
+void arena_cache_finalize(arena_cache_t *cache);
+
+// defined by the scheduler: the cache of the current scheduler.
+arena_cache_t *scheduler_arena_cache();
+
+#endif
@@ -0,0 +1,217 @@
+#include "muco.h"
+#include "muco/broadcast.h"
+
+#include <errno.h>
+#include <error.h>
+#include <stdlib.h>
+
+// Publishers are serialized by the mutex, but subscribers only read the ring
+// without locking, and only take the mutex to wait for a value (empty ring)
+// or to wakeup a blocked publisher (CO_BCAST_BLOCK policy).
+//
+// Publishing first bumps `reserved` then writes the slot and finally bumps
+// `tail`. A subscriber reads a slot then checks `reserved`, as in a seqlock:
+// if the publisher reserved the slot in the meantime (overwrite policies) the
+// value may have been overwritten, and the subscriber lagged behind.
+
+void co_bcast_init(co_bcast_t *self, size_t capacity, co_bcast_policy_t policy) {
+    size_t size = 1;
+    while (size < capacity) size <<= 1;
+
+    self->policy = policy;
+    self->closed = 0;
+    self->waiting = 0;
+
+    self->capacity = size;
+    self->mask = size - 1;
+    self->buf = malloc(sizeof(*self->buf) * size);
+    if (self->buf == NULL) {
+        error(1, errno, "malloc");
+    }
+
+    atomic_init(&self->reserved, 0);
+    atomic_init(&self->tail, 0);
+    atomic_init(&self->blocked, 0);
+
+    self->subs = NULL;
+    co_mtx_init(&self->mutex);
+    co_cond_init(&self->publishers);
+    co_cond_init(&self->receivers);
+}
+
+void co_bcast_destroy(co_bcast_t *self) {
+    free(self->buf);
+}
+
+// Returns the number of values that the slowest subscriber still has to read.
+// Must be called with the mutex held.
+static size_t bcast_backlog(co_bcast_t *self, size_t tail) {
+    size_t backlog = 0;
+
+    for (co_bcast_sub_t *sub = self->subs; sub; sub = sub->next) {
+        size_t n = tail - atomic_load(&sub->cursor);
+        if (n > backlog) backlog = n;
+    }
+    return backlog;
+}
+
+int co_bcast_publish(co_bcast_t *self, void *value) {
+    if (co_mtx_lock(&self->mutex)) return ECANCELED;
+
+    if (self->closed) {
+        co_mtx_unlock(&self->mutex);
+        return -1;
+    }
+
+    size_t tail = atomic_load_explicit(&self->tail, memory_order_relaxed);
+
+    if (self->policy == CO_BCAST_BLOCK) {
+        // wait until the slowest subscriber leaves some room:
+        while (bcast_backlog(self, tail) >= self->capacity) {
+            // publish blocked state then re-check (a subscriber may have
+            // advanced its cursor in between):
+            atomic_store(&self->blocked, 1);
+            if (bcast_backlog(self, tail) < self->capacity) {
+                atomic_store(&self->blocked, 0);
+                break;
+            }
+
+            if (co_cond_wait(&self->publishers, &self->mutex)) {
+                // other publishers may still be blocked: wake them up so
+                // they re-check the backlog and set the blocked state again
+                // (subscribers only wake publishers while it's set):
+                atomic_store(&self->blocked, 0);
+                co_cond_broadcast(&self->publishers);
+                co_mtx_unlock(&self->mutex);
+                return ECANCELED;
+            }
+
+            if (self->closed) {
+                co_mtx_unlock(&self->mutex);
+                return -1;
+            }
+        }
+    }
+
+    // reserve slot, then write value:
+    atomic_store_explicit(&self->reserved, tail + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&self->buf[tail & self->mask], value, memory_order_relaxed);
+
+    // publish value:
+    atomic_store_explicit(&self->tail, tail + 1, memory_order_release);
+
+    // wakeup all waiting subscribers at once:
+    if (self->waiting) {
+        co_cond_broadcast(&self->receivers);
+    }
+
+    co_mtx_unlock(&self->mutex);
+    return 0;
+}
+
+void co_bcast_close(co_bcast_t *self) {
+    co_mtx_lock_nocancel(&self->mutex);
+    self->closed = 1;
+
+    // wakeup pending fibers:
+    co_cond_broadcast(&self->publishers);
+    co_cond_broadcast(&self->receivers);
+
+    co_mtx_unlock(&self->mutex);
+}
+
+void co_bcast_subscribe(co_bcast_t *self, co_bcast_sub_t *sub) {
+    co_mtx_lock_nocancel(&self->mutex);
+
+    // only receive values published from now on:
+    atomic_init(&sub->cursor, atomic_load_explicit(&self->tail, memory_order_relaxed));
+    sub->chan = self;
+    sub->next = self->subs;
+    self->subs = sub;
+
+    co_mtx_unlock(&self->mutex);
+}
+
+void co_bcast_unsubscribe(co_bcast_sub_t *sub) {
+    co_bcast_t *self = sub->chan;
+    co_mtx_lock_nocancel(&self->mutex);
+
+    co_bcast_sub_t **prev = &self->subs;
+    while (*prev && *prev != sub) {
+        prev = &(*prev)->next;
+    }
+    if (*prev) *prev = sub->next;
+
+    // the slowest subscriber may be gone:
+    if (atomic_exchange(&self->blocked, 0)) {
+        co_cond_broadcast(&self->publishers);
+    }
+
+    co_mtx_unlock(&self->mutex);
+}
+
+int co_bcast_receive(co_bcast_sub_t *sub, void **value) {
+    co_bcast_t *self = sub->chan;
+    size_t cursor = atomic_load_explicit(&sub->cursor, memory_order_relaxed);
+
+    while (1) {
+        size_t tail = atomic_load_explicit(&self->tail, memory_order_acquire);
+
+        if (cursor == tail) {
+            // wait until a value is published:
+            if (co_mtx_lock(&self->mutex)) return ECANCELED;
+            while (cursor == atomic_load_explicit(&self->tail, memory_order_relaxed)) {
+                if (self->closed) {
+                    co_mtx_unlock(&self->mutex);
+                    return -1;
+                }
+                self->waiting++;
+                int err = co_cond_wait(&self->receivers, &self->mutex);
+                self->waiting--;
+                if (err) {
+                    // we may have consumed a wakeup: pass it on to the other
+                    // subscribers if a value has been published:
+                    if (self->waiting && cursor != atomic_load_explicit(&self->tail, memory_order_relaxed)) {
+                        co_cond_broadcast(&self->receivers);
+                    }
+                    co_mtx_unlock(&self->mutex);
+                    return err;
+                }
+            }
+            co_mtx_unlock(&self->mutex);
+            continue;
+        }
+
+        void *v = atomic_load_explicit(&self->buf[cursor & self->mask], memory_order_relaxed);
+        atomic_thread_fence(memory_order_acquire);
+        size_t reserved = atomic_load_explicit(&self->reserved, memory_order_relaxed);
+
+        if (reserved - cursor > self->capacity) {
+            // slot has been overwritten: skip to the oldest value in ring:
+            cursor = reserved - self->capacity;
+
+            if (self->policy == CO_BCAST_LAG) {
+                atomic_store_explicit(&sub->cursor, cursor, memory_order_relaxed);
+                return CO_BCAST_LAGGED;
+            }
+            continue;
+        }
+
+        if (self->policy == CO_BCAST_BLOCK) {
+            atomic_store(&sub->cursor, cursor + 1);
+
+            // wakeup blocked publisher (if any):
+            if (atomic_load(&self->blocked) && atomic_exchange(&self->blocked, 0)) {
+                co_mtx_lock_nocancel(&self->mutex);
+                co_cond_broadcast(&self->publishers);
+                co_mtx_unlock(&self->mutex);
+            }
+        } else {
+            atomic_store_explicit(&sub->cursor, cursor + 1, memory_order_relaxed);
+        }
+
+        *value = v;
+        return 0;
+    }
+}
@@ -1,6 +1,7 @@
 #include "muco.h"
 #include "muco/channel.h"
 
+#include <errno.h>
 #include <stdlib.h>
 #include <stdio.h>
 
@@ -37,10 +38,14 @@ void co_chan_destroy(chan_t *self) {
     free(self->buf);
 }
 
+static void chan_unlock(void *data) {
+    co_mtx_unlock((co_mtx_t *)data);
+}
+
 int co_chan_send(chan_t *self, void *value) {
     if (self->state) return -1;
 
-    co_mtx_lock(&self->mutex);
+    if (co_mtx_lock(&self->mutex)) return ECANCELED;
 
     // wait until the channel queue has some room for a value:
     while (co_chan_full(self)) {
@@ -48,7 +53,12 @@ int co_chan_send(chan_t *self, void *value) {
             co_mtx_unlock(&self->mutex);
             return -1;
         }
-        co_cond_wait(&self->senders, &self->mutex);
+        if (co_cond_wait(&self->senders, &self->mutex)) {
+            // we may have consumed a signal: pass it on to another sender:
+            if (!co_chan_full(self)) co_cond_signal(&self->senders);
+            co_mtx_unlock(&self->mutex);
+            return ECANCELED;
+        }
     }
 
     // enqueue item:
@@ -60,21 +70,23 @@ int co_chan_send(chan_t *self, void *value) {
     // wakeup one waiting receiver:
     co_cond_signal(&self->receivers);
 
-    // done.
-    co_mtx_unlock(&self->mutex);
-
-    // if synchronous: suspend until a receiver got the value:
+    // if synchronous: suspend until a receiver got the value (only unlocking
+    // once suspended, since the receiver will enqueue the current fiber). The
+    // value has been sent already, so this isn't cancellable:
     if (!self->async) {
-        co_suspend();
+        co_suspend_then(chan_unlock, &self->mutex);
+        return 0;
     }
 
+    // done.
+    co_mtx_unlock(&self->mutex);
     return 0;
 }
 
 int co_chan_receive(chan_t *self, void **value) {
     if (self->state == chan_closed) return -1;
 
-    co_mtx_lock(&self->mutex);
+    if (co_mtx_lock(&self->mutex)) return ECANCELED;
 
     // wait until the channel queue has a value:
     while (co_chan_empty(self)) {
@@ -82,7 +94,12 @@ int co_chan_receive(chan_t *self, void **value) {
             co_mtx_unlock(&self->mutex);
             return -1;
         }
-        co_cond_wait(&self->receivers, &self->mutex);
+        if (co_cond_wait(&self->receivers, &self->mutex)) {
+            // we may have consumed a signal: pass it on to another receiver:
+            if (!co_chan_empty(self)) co_cond_signal(&self->receivers);
+            co_mtx_unlock(&self->mutex);
+            return ECANCELED;
+        }
     }
 
     // dequeue item:
@@ -116,7 +133,7 @@ int co_chan_receive(chan_t *self, void **value) {
 void co_chan_close(chan_t *self) {
     if (self->state) return;
 
-    co_mtx_lock(&self->mutex);
+    co_mtx_lock_nocancel(&self->mutex);
 
     // close immediately or delay until the channel queue is emptied:
     if (co_chan_empty(self)) {
@@ -19,9 +19,17 @@
 #define STACK_OFFSET (0)
 #define STACK_SIZE (8 * 1024 * 1024)
 
-int co_nprocs;
-static int co_running;
-static void *co_schedulers;
-static pthread_key_t tl_scheduler;
+// Fiber arenas: usable bytes of a chunk, and how many free chunks each
+// scheduler keeps.
+#define ARENA_CHUNK_SIZE (16 * 1024)
+#define ARENA_CACHE_SIZE (64)
+
+// Thread-local variables use the initial-exec model: the library is linked
+// statically, or loaded at startup, and accesses are then a single load
+// relative to the thread pointer.
+#define CO_TLS __thread __attribute__((tls_model("initial-exec")))
+
+// must match muco.h:
+#define CO_PROCS_AUTO (-1)
 
 #endif
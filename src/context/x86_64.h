@@ -5,7 +5,7 @@
 
 // http://cons.mit.edu/fa16/x86-64-architecture-guide.html#registers
 
-#define STACK_ALIGN_MASK (~(uintptr_t)16)
+#define STACK_ALIGN_MASK (~(uintptr_t)15)
 #define WORD_SIZE sizeof(uintptr_t)
 
 static void fiber_makecontext(fiber_t *self) {
@@ -36,12 +36,16 @@ static void fiber_main_makecontext(fiber_t *self) {
     self->stack_top = (char *)&registers - WORD_SIZE;
 }
 
-__attribute__((naked)) void co_setcontext(
-        __attribute__((__unused__)) fiber_t *fiber
+// Both co_setcontext and co_swapcontext pass `data` to the resumed fiber, as
+// the return value of the co_swapcontext call that suspended it.
+
+__attribute__((naked, noinline)) void *co_setcontext(
+        __attribute__((__unused__)) fiber_t *fiber,
+        __attribute__((__unused__)) void *data
 ) {
     __asm__ volatile (
-        "movl $0, 0(%rdi);"    // fiber->resumeable = 0
-        "movq 8(%rdi), %rsp;"  // rsp = fiber->stack_top
+        "movq %rsi, %rax;"     // return data
+        "movq 0(%rdi), %rsp;"  // rsp = fiber->stack_top
         "popq %r15;"
         "popq %r14;"
         "popq %r13;"
@@ -53,9 +57,10 @@ __attribute__((naked)) void co_setcontext(
     );
 }
 
-__attribute__((naked)) void co_swapcontext(
+__attribute__((naked, noinline)) void *co_swapcontext(
         __attribute__((__unused__)) fiber_t *curr,
-        __attribute__((__unused__)) fiber_t *next
+        __attribute__((__unused__)) fiber_t *next,
+        __attribute__((__unused__)) void *data
 ) {
     __asm__ volatile (
         // getcontext (curr):
@@ -66,12 +71,11 @@ __attribute__((naked)) void co_swapcontext(
         "pushq %r13;"
         "pushq %r14;"
         "pushq %r15;"
-        "movq %rsp, 8(%rdi);"  // save stack top (curr->stack_top = rsp)
-        "movl $1, 0(%rdi);"    // set previous fiber as resumeable (curr->resumeable = 1)
+        "movq %rsp, 0(%rdi);"  // save stack top (curr->stack_top = rsp)
 
         // setcontext (next):
-        "movl $0, (%rsi);"     // set next fiber as non resumeable (next->resumeable = 0)
-        "movq 8(%rsi), %rsp;"  // load stack top (rsp = next->stack_top)
+        "movq %rdx, %rax;"     // return data
+        "movq 0(%rsi), %rsp;"  // load stack top (rsp = next->stack_top)
         "popq %r15;"           // pop callee-saved registers from the stack
         "popq %r14;"
         "popq %r13;"
@@ -82,3 +86,18 @@ __attribute__((naked)) void co_swapcontext(
         "retq;"                // popq rpi
     );
 }
+
+// Entry of a fiber prepared by fiber_jump_makecontext (see muco/context.h):
+// co_jumpcontext already switched the stack.
+__attribute__((naked, noinline)) void co_jump_enter(void) {
+    __asm__ volatile (
+        "popq %r15;"
+        "popq %r14;"
+        "popq %r13;"
+        "popq %r12;"
+        "popq %rbp;"
+        "popq %rbx;"
+        "popq %rdi;"
+        "retq;"            // popq rpi
+    );
+}
@@ -2,15 +2,30 @@
 #define MUCO_FIBER_PRIV_H
 
 #include "stack.h"
+#include "arena.h"
+#include "fls.h"
+#include <stdatomic.h>
 
 typedef struct fiber fiber_t;
+struct scheduler;
+struct co_nursery;
+struct co_cancel;
+struct co_gen;
 typedef void (*fiber_main_t)();
 typedef void (*fiber_exit_t)(fiber_t *);
 typedef void (*fiber_run_t)(fiber_t *);
 static void fiber_run(fiber_t *);
 
+// defined by the scheduler:
+static void on_fiber_start();
+
+// must match co_priority_t:
+#define FIBER_PRIORITY_HIGH (0)
+#define FIBER_PRIORITY_NORMAL (1)
+#define FIBER_PRIORITY_BACKGROUND (2)
+#define FIBER_PRIORITY_LEVELS (3)
+
 typedef struct fiber {
-    long resumeable; // don't move: required by context asm
     void *stack_top; // don't move: required by context asm
 
     stack_t stack;
@@ -19,6 +34,23 @@ typedef struct fiber {
     fiber_exit_t link;
 
     fiber_t *m_next;
+    int priority;
+
+    struct scheduler *home; // last scheduler that resumed the fiber
+    int pinned;             // never migrates from home
+
+    fiber_t *peer;          // last fiber that woke this fiber up
+    int coupling;           // consecutive wakeups by peer
+
+    struct co_nursery *nursery;       // waits for the fiber (if any)
+    struct co_cancel *cancel;         // cancellation token (if any)
+    _Atomic unsigned long generation; // incremented on exit (see co_join)
+    _Atomic int joiners;              // fibers are parked on the fiber
+    _Atomic int handles;              // outstanding join handles
+
+    void *fls[FIBER_FLS_SLOTS];       // fiber-local storage
+    arena_chunk_t *arena;             // chunks of co_arena_alloc
+    struct co_gen *gen;               // generator run by the fiber (if any)
 
     char *name;
 } fiber_t;
@@ -30,18 +62,43 @@ typedef struct fiber {
 #include <stdlib.h>
 
 static void fiber_initialize(fiber_t *self, fiber_main_t proc, fiber_exit_t link, char *name) {
-    self->resumeable = 1;
     self->proc = proc;
     self->link = link;
+    self->priority = FIBER_PRIORITY_NORMAL;
+    self->home = NULL;
+    self->pinned = 0;
+    self->peer = NULL;
+    self->coupling = 0;
+    self->nursery = NULL;
+    self->cancel = NULL;
     fiber_makecontext(self);
     self->name = name;
 }
 
+// Clears the fiber-local storage slots, calling the destructor of the keys
+// for the slots that are set. Runs on the exiting fiber, so a recycled fiber
+// always starts with empty slots.
+static void fiber_fls_release(fiber_t *self) {
+    int keys = atomic_load_explicit(&fiber_fls_keys, memory_order_acquire);
+    if (keys > FIBER_FLS_SLOTS) keys = FIBER_FLS_SLOTS;
+
+    for (int key = 0; key < keys; key++) {
+        void *value = self->fls[key];
+
+        if (value) {
+            self->fls[key] = NULL;
+            if (fiber_fls_destructors[key]) fiber_fls_destructors[key](value);
+        }
+    }
+}
+
 static void fiber_finalize(fiber_t *self) {
+    arena_free(self->arena);
     stack_deallocate(&self->stack);
 }
 
 static void fiber_run(fiber_t *self) {
+    on_fiber_start();
     self->proc();
     if (self->link) {
         self->link(self);
@@ -53,8 +110,8 @@ static fiber_t *fiber_main(void) {
     if (self == NULL) {
         error(1, errno, "calloc");
     }
-    self->resumeable = 0;
     self->name = "main";
+    self->priority = FIBER_PRIORITY_NORMAL;
     fiber_main_makecontext(self);
     return self;
 }
@@ -0,0 +1,20 @@
+#include "muco.h"
+#include "fls.h"
+
+#include <errno.h>
+
+fiber_fls_destructor_t fiber_fls_destructors[FIBER_FLS_SLOTS];
+atomic_int fiber_fls_keys;
+
+int co_fls_key_create(co_fls_key_t *key, co_fls_destructor_t destructor) {
+    int k = atomic_load(&fiber_fls_keys);
+
+    do {
+        if (k >= FIBER_FLS_SLOTS) return EAGAIN;
+    } while (!atomic_compare_exchange_weak(&fiber_fls_keys, &k, k + 1));
+
+    // published before the key is handed out (see fiber_fls_release):
+    fiber_fls_destructors[k] = destructor;
+    *key = k;
+    return 0;
+}
@@ -0,0 +1,16 @@
+#ifndef MUCO_FLS_PRIV_H
+#define MUCO_FLS_PRIV_H
+
+#include <stdatomic.h>
+
+// must match CO_FLS_SLOTS:
+#define FIBER_FLS_SLOTS (16)
+
+typedef void (*fiber_fls_destructor_t)(void *);
+
+// Destructors of the fiber-local storage keys (shared by all the runtimes),
+// and number of allocated keys (see co_fls_key_create).
+extern fiber_fls_destructor_t fiber_fls_destructors[FIBER_FLS_SLOTS];
+extern atomic_int fiber_fls_keys;
+
+#endif
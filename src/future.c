@@ -0,0 +1,188 @@
+#include "muco.h"
+#include "muco/future.h"
+#include "spin.h"
+
+#if defined(DEBUG) || defined(FUTURE_DEBUG)
+#  include <error.h>
+#endif
+
+// The state of a future is FUTURE_EMPTY, FUTURE_SET or a pointer to the
+// waiter record (on the stack of the waiting fiber). The promise claims the
+// record by setting the FUTURE_BUSY bit, decrements the pending counter, then
+// marks the future as set; the waiting fiber mustn't return (invalidating the
+// record) while a promise is busy with it.
+//
+// The pending counter holds one reference for the registration itself, so
+// promises set while the fiber registers into many futures can't resume it
+// before it's done: the fiber is enqueued by whoever drops the counter to
+// zero. When waiting for all futures, each future holds a reference. When
+// waiting for any future, a single reference is shared by all of them: the
+// first promise (or the registration, for a future already set) to claim the
+// `fired` flag drops it, the others leave the counter alone.
+
+#define FUTURE_EMPTY ((uintptr_t)0)
+#define FUTURE_SET ((uintptr_t)1)
+#define FUTURE_BUSY ((uintptr_t)2)
+
+typedef struct {
+    fiber_t *fiber;
+    atomic_int pending;
+    atomic_int fired;
+    int any;
+} future_waiter_t;
+
+typedef struct {
+    co_future_t **futures;
+    int count;
+    int any;
+    future_waiter_t *waiter;
+} future_wait_t;
+
+// Whether the caller holds a reference of the pending counter for a future
+// that is set.
+static int future_fire(future_waiter_t *waiter) {
+    return !waiter->any || !atomic_exchange_explicit(&waiter->fired, 1, memory_order_relaxed);
+}
+
+void co_future_init(co_future_t *self) {
+    atomic_init(&self->state, FUTURE_EMPTY);
+    self->value = NULL;
+}
+
+void co_promise_set(co_future_t *self, void *value) {
+    self->value = value;
+
+    uintptr_t state = atomic_load_explicit(&self->state, memory_order_relaxed);
+
+    while (1) {
+        if (state == FUTURE_EMPTY) {
+            // nobody waits (yet):
+            if (atomic_compare_exchange_weak_explicit(&self->state, &state, FUTURE_SET,
+                        memory_order_release, memory_order_relaxed)) {
+                return;
+            }
+            continue;
+        }
+
+        // claim the waiter record:
+        if (atomic_compare_exchange_weak_explicit(&self->state, &state, state | FUTURE_BUSY,
+                    memory_order_acquire, memory_order_relaxed)) {
+            break;
+        }
+    }
+
+    future_waiter_t *waiter = (future_waiter_t *)state;
+    fiber_t *fiber = NULL;
+
+    if (future_fire(waiter) &&
+            atomic_fetch_sub_explicit(&waiter->pending, 1, memory_order_acq_rel) == 1) {
+        fiber = waiter->fiber;
+    }
+
+    // release the record (it may be invalid from now on):
+    atomic_store_explicit(&self->state, FUTURE_SET, memory_order_release);
+
+    // the fiber can't be resumed until it's enqueued:
+    if (fiber) {
+        co_enqueue(fiber);
+    }
+}
+
+int co_future_ready(co_future_t *self) {
+    return atomic_load_explicit(&self->state, memory_order_acquire) == FUTURE_SET;
+}
+
+static void future_register(void *arg) {
+    future_wait_t *wait = arg;
+    future_waiter_t *waiter = wait->waiter;
+    fiber_t *fiber = waiter->fiber;
+    int done = 1;
+
+    for (int i = 0; i < wait->count; i++) {
+        uintptr_t state = FUTURE_EMPTY;
+
+        if (!atomic_compare_exchange_strong_explicit(&wait->futures[i]->state, &state,
+                    (uintptr_t)waiter, memory_order_acq_rel, memory_order_acquire)) {
+            // already set: no need to register into the other futures when
+            // waiting for any of them:
+            done += future_fire(waiter);
+            if (wait->any) break;
+        }
+    }
+
+    // drop our reference along with the futures already set: `wait` may be
+    // invalid from now on:
+    if (atomic_fetch_sub_explicit(&waiter->pending, done, memory_order_acq_rel) == done) {
+        co_enqueue(fiber);
+    }
+}
+
+static void future_deregister(co_future_t *self, future_waiter_t *waiter) {
+    uintptr_t state = (uintptr_t)waiter;
+
+    if (atomic_compare_exchange_strong_explicit(&self->state, &state, FUTURE_EMPTY,
+                memory_order_relaxed, memory_order_relaxed)) {
+        return;
+    }
+
+    // a promise may be busy with our record:
+    int count = SPIN_LOCK_THRESHOLD;
+    while (atomic_load_explicit(&self->state, memory_order_acquire) ==
+            ((uintptr_t)waiter | FUTURE_BUSY)) {
+        if (count) {
+            count--;
+            spin_pause();
+        } else {
+            sched_yield();
+        }
+    }
+}
+
+static void future_wait(co_future_t **futures, int count, int any) {
+#if defined(DEBUG) || defined(FUTURE_DEBUG)
+    // co_cancel wouldn't wake the fiber up:
+    if (co_current()->cancel) {
+        error(1, 0, "fiber %p [%s] waits for a future with a cancellation token",
+                (void *)co_current(), co_current()->name);
+    }
+#endif
+    future_waiter_t waiter = { co_current(), (any ? 1 : count) + 1, 0, any };
+    future_wait_t wait = { futures, count, any, &waiter };
+
+    co_suspend_then(future_register, &wait);
+
+    for (int i = 0; i < count; i++) {
+        future_deregister(futures[i], &waiter);
+    }
+}
+
+void *co_future_wait(co_future_t *self) {
+    if (!co_future_ready(self)) {
+        future_wait(&self, 1, 0);
+    }
+    return self->value;
+}
+
+int co_future_wait_any(co_future_t **futures, int count) {
+    if (count == 0) return -1;
+
+    for (int i = 0; i < count; i++) {
+        if (co_future_ready(futures[i])) return i;
+    }
+
+    future_wait(futures, count, 1);
+
+    for (int i = 0; i < count; i++) {
+        if (co_future_ready(futures[i])) return i;
+    }
+    return -1;
+}
+
+void co_future_wait_all(co_future_t **futures, int count) {
+    for (int i = 0; i < count; i++) {
+        if (!co_future_ready(futures[i])) {
+            future_wait(futures, count, 0);
+            return;
+        }
+    }
+}
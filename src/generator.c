@@ -0,0 +1,32 @@
+#include "muco.h"
+#include "muco/generator.h"
+
+// The generator's fiber points to the generator, so co_gen_yield finds it
+// without a thread-local, and the scheduler of the iterating fiber is read
+// once by co_gen_next. Only the generator and its caller ever resume each
+// other, so they switch with co_jumpcontext (see muco/generator.h).
+
+static void co_gen_run() {
+    co_gen_t *gen = co_tl_current->gen;
+    gen->proc(gen->arg);
+    gen->done = 1;
+
+    // never resumed:
+    co_gen_switch(gen, gen->fiber, gen->caller, NULL);
+}
+
+void co_gen_init(co_gen_t *gen, co_gen_fn_t proc, void *arg) {
+    gen->fiber = co_fiber_new(co_gen_run);
+    gen->fiber->name = "generator";
+    gen->fiber->gen = gen;
+    fiber_jump_makecontext(gen->fiber);
+    gen->caller = NULL;
+    gen->scheduler = NULL;
+    gen->proc = proc;
+    gen->arg = arg;
+    gen->done = 0;
+}
+
+void co_gen_destroy(co_gen_t *gen) {
+    co_fiber_free(gen->fiber);
+}
@@ -0,0 +1,90 @@
+#include "muco.h"
+#include "muco/join.h"
+#include "parking_lot.h"
+
+#include <errno.h>
+#include <stdatomic.h>
+
+// Join handles, cancellation tokens and nurseries. Spawning a fiber with a
+// handle, or in a nursery, is up to the scheduler (see co_spawn_handle and
+// co_nursery_spawn).
+
+static int join_validate(void *data) {
+    co_handle_t *handle = data;
+    atomic_store(&handle->fiber->joiners, 1);
+    return atomic_load(&handle->fiber->generation) == handle->generation;
+}
+
+int co_join(co_handle_t handle) {
+    fiber_t *fiber = handle.fiber;
+
+    while (atomic_load(&fiber->generation) == handle.generation) {
+        if (parking_lot_park(fiber, join_validate, NULL, &handle, 0, NULL) < 0) {
+            return ECANCELED;
+        }
+    }
+    atomic_fetch_sub(&fiber->handles, 1);
+    return 0;
+}
+
+void co_detach(co_handle_t handle) {
+    atomic_fetch_sub(&handle.fiber->handles, 1);
+}
+
+void co_cancel_init(co_cancel_t *token) {
+    atomic_init(&token->cancelled, 0);
+    token->parent = co_tl_current ? co_tl_current->cancel : NULL;
+}
+
+int co_cancel_requested(co_cancel_t *token) {
+    for (; token; token = token->parent) {
+        if (atomic_load_explicit(&token->cancelled, memory_order_relaxed)) return 1;
+    }
+    return 0;
+}
+
+static int cancel_match(fiber_t *fiber, void *data) {
+    for (co_cancel_t *token = fiber->cancel; token; token = token->parent) {
+        if (token == data) return 1;
+    }
+    return 0;
+}
+
+// Fibers check their token (with the bucket locked) before they park, so the
+// token must be cancelled before walking the parking lot.
+void co_cancel(co_cancel_t *token) {
+    if (atomic_exchange(&token->cancelled, 1)) return;
+    parking_lot_cancel(cancel_match, token);
+}
+
+co_cancel_t *co_set_cancel(co_cancel_t *token) {
+    fiber_t *fiber = co_tl_current;
+    co_cancel_t *previous = fiber->cancel;
+    fiber->cancel = token;
+    return previous;
+}
+
+int co_cancelled() {
+    fiber_t *fiber = co_tl_current;
+    return fiber && fiber->cancel ? co_cancel_requested(fiber->cancel) : 0;
+}
+
+void co_nursery_init(co_nursery_t *nursery) {
+    co_waitgroup_init(&nursery->group);
+    co_cancel_init(&nursery->cancel);
+}
+
+void co_nursery_cancel(co_nursery_t *nursery) {
+    co_cancel(&nursery->cancel);
+}
+
+int co_nursery_cancelled(co_nursery_t *nursery) {
+    return co_cancel_requested(&nursery->cancel);
+}
+
+void co_nursery_wait(co_nursery_t *nursery) {
+    // children may refer to the nursery until they return:
+    co_cancel_t *token = co_set_cancel(NULL);
+    co_waitgroup_wait(&nursery->group);
+    co_set_cancel(token);
+}
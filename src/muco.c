@@ -1,84 +1,408 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include "scheduler.h"
+#include "muco.h"
 #include <error.h>
+#include <limits.h>
+#include <sched.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// automatic mode: the number of active schedulers follows the run queues,
+// checked every interval (in ms), up to the usable CPUs (checked every
+// second):
+#define CO_PROCS_INTERVAL (10)
+
+#define CO_SCHEDULER (co_tl_scheduler)
+
+// the runtime of co_init, co_run, ...
+static co_runtime_t co_default_runtime;
+
+CO_TLS scheduler_t *co_tl_scheduler;
+CO_TLS fiber_t *co_tl_current;
+
+static int co_affinity_cpus();
+static int co_cpus();
+
+static void co_runtime_initialize(co_runtime_t *self, int n) {
+    // may grow up to all the CPUs the process may run on (see co_set_procs),
+    // but only the requested schedulers are created for now:
+    int max = n;
+    if (n > 0 && co_affinity_cpus() > max) {
+        max = co_affinity_cpus();
+    }
+    int c = (n == 0) ? 1 : n;
 
-static pthread_mutex_t mutex;
-static pthread_cond_t cond;
+    atomic_init(&self->nprocs, n);
+    self->maxprocs = max;
+    self->running = 0;
+    self->wake_policy = SCHEDULER_WAKE_LOCAL;
 
-#define CO_SCHEDULER ((scheduler_t *)pthread_getspecific(tl_scheduler))
+    atomic_init(&self->park_count, 0);
+
+    pthread_mutex_init(&self->mutex, NULL);
+    pthread_cond_init(&self->cond, NULL);
+    self->procs_auto = 0;
+    self->threads = NULL;
+    self->nthreads = 0;
+
+    self->schedulers = calloc(max == 0 ? 1 : max, sizeof(scheduler_t));
+    if (self->schedulers == NULL) {
+        error(1, errno, "calloc");
+    }
+    for (int i = 0; i < c; i++) {
+        scheduler_initialize(self->schedulers + i, self, 32 + i);
+    }
+    atomic_init(&self->started, c);
+}
+
+static void co_runtime_finalize(co_runtime_t *self) {
+    int c = atomic_load(&self->started);
+
+    for (int i = 0; i < c; i++) {
+        scheduler_finalize(self->schedulers + i);
+    }
+    free(self->schedulers);
+
+    pthread_mutex_destroy(&self->mutex);
+    pthread_cond_destroy(&self->cond);
+}
 
 void co_init(int n) {
     if (n < 0) {
         error(0, 0, "WARNING: ignoring invalid nprocs=%d\n", n);
         n = 1;
     }
-    int c = (n == 0) ? 1 : n;
+    co_runtime_initialize(&co_default_runtime, n);
+
+    // the main thread runs the first scheduler until co_run:
+    co_tl_scheduler = co_default_runtime.schedulers;
+    co_tl_current = co_tl_scheduler->current;
+}
+
+void co_free() {
+    co_runtime_finalize(&co_default_runtime);
+}
+
+// Creates an independent runtime, with its own schedulers (at least one
+// thread). Fibers are added with co_runtime_spawn, then co_runtime_run (or
+// co_runtime_start) starts its threads.
+co_runtime_t *co_runtime_new(int n) {
+    co_runtime_t *self = malloc(sizeof(co_runtime_t));
+    if (self == NULL) {
+        error(1, errno, "malloc");
+    }
+    co_runtime_initialize(self, n < 1 ? 1 : n);
+    return self;
+}
+
+void co_runtime_free(co_runtime_t *self) {
+    co_runtime_finalize(self);
+    free(self);
+}
+
+// Runtime of the current thread (the default runtime for foreign threads).
+co_runtime_t *co_runtime() {
+    return CO_SCHEDULER ? CO_SCHEDULER->runtime : &co_default_runtime;
+}
+
+// Number of CPUs in the affinity mask of the process.
+static int co_affinity_cpus() {
+    cpu_set_t set;
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        return CPU_COUNT(&set);
+    }
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? n : 1;
+}
 
-    pthread_mutex_init(&mutex, NULL);
-    pthread_cond_init(&cond, NULL);
-    pthread_key_create(&tl_scheduler, NULL);
+// Reads a cgroup v2 cpu.max file ("$MAX $PERIOD"). Returns the quota in CPUs
+// (rounded up) or 0 when unlimited (or unreadable).
+static int co_cgroup_cpus(const char *path) {
+    FILE *file = fopen(path, "r");
+    if (!file) return 0;
 
-    co_nprocs = n;
-    co_schedulers = calloc(c, sizeof(scheduler_t));
-    scheduler_initialize(co_schedulers, 32);
+    char max[32];
+    long period = 0;
+    int n = fscanf(file, "%31s %ld", max, &period);
+    fclose(file);
 
-    for (int i = 1; i < co_nprocs; i++) {
-        scheduler_initialize((scheduler_t *)co_schedulers + i, 32 + i);
+    if (n != 2 || period <= 0 || strcmp(max, "max") == 0) return 0;
+    long quota = atol(max);
+    return quota > 0 ? (quota + period - 1) / period : 0;
+}
+
+// Smallest CPU quota of the cgroup of the process and its parents (cgroup v2,
+// e.g. containers), or 0 when unlimited.
+static int co_quota_cpus() {
+    char cgroup[PATH_MAX] = "";
+    char path[PATH_MAX + 32];
+    int cpus = 0;
+
+    FILE *file = fopen("/proc/self/cgroup", "r");
+    if (file) {
+        char line[PATH_MAX];
+        while (fgets(line, sizeof(line), file)) {
+            if (strncmp(line, "0::", 3) == 0) {
+                line[strcspn(line, "\n")] = '\0';
+                snprintf(cgroup, sizeof(cgroup), "%s", line + 3);
+                break;
+            }
+        }
+        fclose(file);
     }
 
-    pthread_setspecific(tl_scheduler, co_schedulers);
+    while (1) {
+        snprintf(path, sizeof(path), "/sys/fs/cgroup%s/cpu.max", cgroup);
+        int n = co_cgroup_cpus(path);
+        if (n > 0 && (cpus == 0 || n < cpus)) cpus = n;
+
+        char *slash = strrchr(cgroup, '/');
+        if (!slash) break;
+        *slash = '\0';
+    }
+    return cpus;
+}
+
+// Number of CPUs the process may actually use: CPUs in its affinity mask,
+// limited by its CPU quota.
+static int co_cpus() {
+    int cpus = co_affinity_cpus();
+    int quota = co_quota_cpus();
+    return (quota > 0 && quota < cpus) ? quota : cpus;
 }
 
+// Number of schedulers to start: NPROCS (if set) or the usable CPUs.
 int co_procs() {
     char *nprocs = getenv("NPROCS");
     if (nprocs) {
         return atoi(nprocs);
     }
-    return 4;
+    return co_cpus();
 }
 
-void co_free() {
-    if (co_nprocs == 0) {
-        scheduler_finalize(co_schedulers);
+// Changes the number of active schedulers (between 1 and the number of
+// schedulers allocated when the runtime was created) and returns it. Surplus
+// schedulers move their fibers to the active ones (pinned fibers are
+// unpinned) then park. CO_PROCS_AUTO lets the runtime follow the load
+// instead. Does nothing for a single thread runtime (co_init(0)).
+int co_runtime_set_procs(co_runtime_t *self, int n) {
+    if (self->maxprocs == 0) return 0;
+
+    pthread_mutex_lock(&self->mutex);
+    if (n == CO_PROCS_AUTO) {
+        self->procs_auto = 1;
     } else {
-        for (int i = 0; i < co_nprocs; i++) {
-            scheduler_finalize((scheduler_t *)co_schedulers + i);
+        self->procs_auto = 0;
+        scheduler_resize(self, n);
+    }
+    // the monitor must (re)consider its interval:
+    pthread_cond_signal(&self->cond);
+    pthread_mutex_unlock(&self->mutex);
+
+    return atomic_load(&self->nprocs);
+}
+
+int co_set_procs(int n) {
+    return co_runtime_set_procs(co_runtime(), n);
+}
+
+// Active schedulers of a runtime, and allocated schedulers.
+int co_runtime_nprocs(co_runtime_t *self) {
+    return atomic_load_explicit(&self->nprocs, memory_order_relaxed);
+}
+
+int co_runtime_maxprocs(co_runtime_t *self) {
+    return self->maxprocs;
+}
+
+int co_nprocs() {
+    return co_runtime_nprocs(co_runtime());
+}
+
+int co_maxprocs() {
+    return co_runtime_maxprocs(co_runtime());
+}
+
+// Automatic mode: grows by one scheduler when fibers are waiting in the run
+// queues (more than one per active scheduler), and shrinks by one when more
+// than one active scheduler is parked (found nothing to run or steal).
+static void co_autoscale(co_runtime_t *runtime, int limit) {
+    int nprocs = atomic_load(&runtime->nprocs);
+    size_t depth = 0;
+    int parked = 0;
+
+    for (int i = 0; i < nprocs; i++) {
+        scheduler_t *s = runtime->schedulers + i;
+        for (int level = 0; level < FIBER_PRIORITY_LEVELS; level++) {
+            depth += queue_lazy_size(&s->runnables[level]);
         }
+        parked += atomic_load_explicit(&s->parked, memory_order_relaxed);
     }
-    free(co_schedulers);
 
-    pthread_key_delete(tl_scheduler);
+    if (depth > (size_t)nprocs && nprocs < limit) {
+        scheduler_resize(runtime, nprocs + 1);
+    } else if (parked > 1 || nprocs > limit) {
+        scheduler_resize(runtime, nprocs - 1);
+    }
+}
+
+// Total number of context switches of all schedulers of the current runtime
+// (only accurate once schedulers are stopped).
+unsigned long co_switches() {
+    co_runtime_t *runtime = co_runtime();
+    unsigned long count = 0;
+    int c = atomic_load(&runtime->started);
+
+    for (int i = 0; i < c; i++) {
+        count += runtime->schedulers[i].switches;
+    }
+    return count;
+}
+
+// Total number of fibers resumed by another scheduler than the one that last
+// resumed them (only accurate once schedulers are stopped).
+unsigned long co_migrations() {
+    co_runtime_t *runtime = co_runtime();
+    unsigned long count = 0;
+    int c = atomic_load(&runtime->started);
 
-    pthread_mutex_destroy(&mutex);
-    pthread_cond_destroy(&cond);
+    for (int i = 0; i < c; i++) {
+        count += runtime->schedulers[i].migrations;
+    }
+    return count;
 }
 
-scheduler_t *co_scheduler() {
-    return CO_SCHEDULER;
+int co_queue_size() {
+    scheduler_t *scheduler = CO_SCHEDULER;
+    return queue_lazy_size(&scheduler->runnables[scheduler->current->priority]);
+}
+
+int co_scheduler_id() {
+    return CO_SCHEDULER - CO_SCHEDULER->runtime->schedulers;
 }
 
 fiber_t *co_spawn(fiber_main_t proc) {
-    return scheduler_spawn(CO_SCHEDULER, proc, NULL);
+    return scheduler_spawn(CO_SCHEDULER, proc, NULL, FIBER_PRIORITY_NORMAL);
 }
 
 fiber_t *co_spawn_named(fiber_main_t proc, char *name) {
-    return scheduler_spawn(CO_SCHEDULER, proc, name);
+    return scheduler_spawn(CO_SCHEDULER, proc, name, FIBER_PRIORITY_NORMAL);
+}
+
+fiber_t *co_spawn_priority(fiber_main_t proc, co_priority_t priority) {
+    if ((unsigned int)priority >= FIBER_PRIORITY_LEVELS) {
+        priority = FIBER_PRIORITY_NORMAL;
+    }
+    return scheduler_spawn(CO_SCHEDULER, proc, NULL, priority);
+}
+
+void co_spawn_now(fiber_main_t proc) {
+    scheduler_spawn_now(CO_SCHEDULER, proc, NULL);
+}
+
+co_handle_t co_spawn_handle(fiber_main_t proc) {
+    scheduler_t *scheduler = CO_SCHEDULER;
+    fiber_t *fiber = scheduler_new_fiber(scheduler, proc, NULL, FIBER_PRIORITY_NORMAL);
+
+    // the fiber may exit (and be recycled) as soon as it's enqueued:
+    co_handle_t handle = { fiber, atomic_load(&fiber->generation) };
+    atomic_fetch_add(&fiber->handles, 1);
+
+    LOG("spawn", scheduler, fiber);
+    scheduler_enqueue(scheduler, fiber);
+    return handle;
 }
 
-fiber_t *co_fiber_new(fiber_main_t proc, char *name) {
-    return fiber_new(proc, NULL, name);
+void co_nursery_spawn(co_nursery_t *nursery, fiber_main_t proc) {
+    scheduler_t *scheduler = CO_SCHEDULER;
+    fiber_t *fiber = scheduler_new_fiber(scheduler, proc, NULL, FIBER_PRIORITY_NORMAL);
+    fiber->nursery = nursery;
+    fiber->cancel = &nursery->cancel;
+    co_waitgroup_add(&nursery->group, 1);
+
+    LOG("spawn", scheduler, fiber);
+    scheduler_enqueue(scheduler, fiber);
+}
+
+// Spawns a fiber in a runtime. From another runtime (or thread) the fiber is
+// injected into the first scheduler of the runtime (thieves spread the load).
+fiber_t *co_runtime_spawn(co_runtime_t *runtime, fiber_main_t proc) {
+    scheduler_t *self = CO_SCHEDULER;
+    if (self && self->runtime == runtime) {
+        return scheduler_spawn(self, proc, NULL, FIBER_PRIORITY_NORMAL);
+    }
+
+    fiber_t *fiber = fiber_new(proc, on_fiber_exit, NULL);
+    fiber->home = runtime->schedulers;
+    scheduler_push_remote(runtime->schedulers, fiber);
+    return fiber;
+}
+
+// Changes the priority of the current fiber, which applies the next time it
+// is enqueued.
+void co_set_priority(co_priority_t priority) {
+    if ((unsigned int)priority < FIBER_PRIORITY_LEVELS) {
+        co_tl_current->priority = priority;
+    }
+}
+
+fiber_t *co_fiber_new(fiber_main_t proc) {
+    return fiber_new(proc, NULL, NULL);
 }
 
 void co_fiber_free(fiber_t *fiber) {
     fiber_free(fiber);
 }
 
+arena_cache_t *scheduler_arena_cache() {
+    return &CO_SCHEDULER->arena;
+}
+
+void co_set_wake_policy(co_wake_policy_t policy) {
+    co_runtime()->wake_policy = policy == SCHEDULER_WAKE_HOME ? SCHEDULER_WAKE_HOME : SCHEDULER_WAKE_LOCAL;
+}
+
+// Pins the current fiber to the current scheduler (thread): it will never be
+// stolen, and is always enqueued back to this scheduler when woken.
+void co_pin() {
+    co_tl_current->home = CO_SCHEDULER;
+    co_tl_current->pinned = 1;
+}
+
+void co_unpin() {
+    co_tl_current->pinned = 0;
+}
+
 void co_enqueue(fiber_t *fiber) {
-    scheduler_enqueue(CO_SCHEDULER, fiber);
+    scheduler_t *scheduler = CO_SCHEDULER;
+
+    if (scheduler) {
+        scheduler_wake(scheduler, fiber);
+    } else {
+        scheduler_enqueue_foreign(fiber);
+    }
+}
+
+void co_enqueue_list(fiber_t *fiber) {
+    scheduler_enqueue_list(CO_SCHEDULER, fiber);
+}
+
+void co_enqueue_next(fiber_t *fiber) {
+    scheduler_enqueue_next(CO_SCHEDULER, fiber);
 }
 
 void co_suspend() {
-    scheduler_reschedule(CO_SCHEDULER);
+    scheduler_reschedule(CO_SCHEDULER, NULL, NULL);
+}
+
+void co_suspend_then(scheduler_action_t action, void *data) {
+    scheduler_reschedule(CO_SCHEDULER, action, data);
 }
 
 void co_resume(fiber_t *fiber) {
@@ -89,47 +413,130 @@ void co_yield() {
     scheduler_yield(CO_SCHEDULER);
 }
 
-fiber_t *co_current() {
-  return CO_SCHEDULER->current;
-}
-
 fiber_t *co_main() {
   return CO_SCHEDULER->main;
 }
 
-void co_run() {
-    pthread_t thread;
-    LOG("run", CO_SCHEDULER, NULL);
+// Starts the threads of the schedulers created so far; the others are
+// started when the runtime grows (see co_set_procs). Surplus schedulers
+// start parked.
+void co_runtime_start(co_runtime_t *self) {
+    self->threads = calloc(self->maxprocs, sizeof(pthread_t));
+    if (self->threads == NULL && self->maxprocs) {
+        error(1, errno, "calloc");
+    }
 
-    co_running = 1;
+    pthread_mutex_lock(&self->mutex);
+    self->running = 1;
+    self->nthreads = self->maxprocs ? atomic_load(&self->started) : 0;
 
-    for (int i = 0; i < co_nprocs; i++) {
-        if (pthread_create(&thread, NULL, scheduler_start, (scheduler_t *)co_schedulers + i)) {
+    for (int i = 0; i < self->nthreads; i++) {
+        if (pthread_create(&self->threads[i], NULL, scheduler_start, self->schedulers + i)) {
             error(1, 0, "pthread_create failed");
         }
     }
+    pthread_mutex_unlock(&self->mutex);
+}
 
-    struct timespec ts = {5, 0};
+// Monitors the runtime until co_runtime_break is called, then waits for its
+// threads to stop.
+void co_runtime_wait(co_runtime_t *self) {
+    struct timespec ts;
+    int ticks = 0, limit = co_cpus();
 
-    pthread_mutex_lock(&mutex);
-    while (1) {
-        pthread_cond_timedwait(&cond, &mutex, &ts);
-        if (!co_running) return;
+    pthread_mutex_lock(&self->mutex);
+    while (self->running) {
+        // timedwait expects an absolute time:
+        clock_gettime(CLOCK_REALTIME, &ts);
+        if (self->procs_auto) {
+            ts.tv_nsec += CO_PROCS_INTERVAL * 1000000L;
+            if (ts.tv_nsec >= 1000000000L) {
+                ts.tv_sec++;
+                ts.tv_nsec -= 1000000000L;
+            }
+        } else {
+            ts.tv_sec += 5;
+        }
+
+        int err = pthread_cond_timedwait(&self->cond, &self->mutex, &ts);
+        if (!self->running) break;
+
+        // signaled by co_set_procs:
+        if (err != ETIMEDOUT) continue;
+
+        if (self->procs_auto) {
+            // the CPU quota may change at any time:
+            if (++ticks % (1000 / CO_PROCS_INTERVAL) == 0) {
+                limit = co_cpus();
+            }
+            co_autoscale(self, limit);
 
-        for (int i = 0; i < co_nprocs; i++) {
-            scheduler_t *s = (scheduler_t *)co_schedulers + i;
+            // free pending fibers every 5 seconds:
+            if (ticks < 5000 / CO_PROCS_INTERVAL) continue;
+            ticks = 0;
+        }
+
+        for (int i = 0; i < self->nthreads; i++) {
+            scheduler_t *s = self->schedulers + i;
             int count = queue_lazy_size(&s->pending) / 2;
             scheduler_free_pending(s, count);
         }
-        if (!co_running) return;
     }
-    pthread_mutex_unlock(&mutex);
+    // no thread is created once stopped:
+    int nthreads = self->nthreads;
+    pthread_mutex_unlock(&self->mutex);
+
+    // wakeup parked threads, then wait for all threads to stop (fibers don't
+    // switch back to the main fiber of their thread until then) before
+    // schedulers may be freed:
+    scheduler_unpark_all(self);
+
+    for (int i = 0; i < nthreads; i++) {
+        pthread_join(self->threads[i], NULL);
+    }
+    free(self->threads);
+    self->threads = NULL;
+    self->nthreads = 0;
+}
+
+void co_runtime_run(co_runtime_t *self) {
+    co_runtime_start(self);
+    co_runtime_wait(self);
+}
+
+void co_runtime_break(co_runtime_t *self) {
+    pthread_mutex_lock(&self->mutex);
+    self->running = 0;
+    pthread_cond_signal(&self->cond);
+    pthread_mutex_unlock(&self->mutex);
+}
+
+int co_run_once(int budget) {
+    return scheduler_run_once(CO_SCHEDULER, budget, 0);
+}
+
+int co_run_for(long usec) {
+    uint64_t deadline = scheduler_clock() + (uint64_t)usec * 1000;
+    return scheduler_run_once(CO_SCHEDULER, 0, deadline);
+}
+
+int co_poll() {
+    scheduler_t *scheduler = CO_SCHEDULER;
+    int count = scheduler_ready(scheduler);
+    return count ? scheduler_run_once(scheduler, count, 0) : 0;
+}
+
+int co_event_fd() {
+    return scheduler_event_fd(CO_SCHEDULER);
+}
+
+void co_run() {
+    LOG("run", CO_SCHEDULER, NULL);
+    co_runtime_run(&co_default_runtime);
 }
 
+// Stops the runtime of the current thread.
 void co_break() {
     LOG("break", CO_SCHEDULER, NULL);
-    pthread_mutex_lock(&mutex);
-    co_running = 0;
-    pthread_cond_signal(&cond);
-    pthread_mutex_unlock(&mutex);
+    co_runtime_break(co_runtime());
 }
@@ -2,8 +2,10 @@
 #define MUCO_MUTEX_PRIV_H
 
 #include "muco.h"
+#include "muco/join.h"
 #include "muco/mutex.h"
-#include "spin.h"
+#include "parking_lot.h"
+#include <errno.h>
 #include <stdlib.h>
 #include <time.h>
 
@@ -14,158 +16,290 @@
 #  define LOG(...)
 #endif
 
-#define SPIN_LOCK(x) spin_lock_flag(&(x)->busy);
-#define SPIN_UNLOCK(x) spin_unlock_flag(&(x)->busy);
+// mutex state bits:
+#define MTX_LOCKED (1U)
+#define MTX_PARKED (2U)
+
+// Number of times to retry acquiring the lock before parking the current
+// fiber (only if no fiber is parked already).
+#define MTX_SPIN_COUNT (10)
+
+// A fiber blocked for longer than this (in nanoseconds) is starving: unlock
+// hands the lock over directly instead of releasing it, so barging fibers
+// can't steal it again.
+#ifndef MTX_STARVATION_THRESHOLD
+#define MTX_STARVATION_THRESHOLD (1000000)
+#endif
+
+static inline uint64_t mtx_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
 
 void co_mtx_init(co_mtx_t *m) {
-    atomic_init(&m->held, 0);
-    m->busy = (atomic_flag)ATOMIC_FLAG_INIT;
-    m->blocking.head = NULL;
-    m->blocking.tail = NULL;
+    atomic_init(&m->state, 0);
 }
 
-int co_mtx_lock(co_mtx_t *m) {
-    LOG("%p: co_mtx_lock\n", (void *)m);
+static int mtx_validate(void *data) {
+    co_mtx_t *m = data;
 
-    // try to acquire lock (without spin lock):
-    if (co_mtx_trylock(m) == 0) {
-        LOG("%p: co_mtx_lock (acquired=trylock)\n", (void *)m);
-        return 0;
-    }
+    // only park if the lock is still held and the parked bit still set
+    // (otherwise unlock may have already run, and we'd never be unparked):
+    return atomic_load_explicit(&m->state, memory_order_relaxed) == (MTX_LOCKED | MTX_PARKED);
+}
 
-    fiber_t *current = co_current();
+static int mtx_lock_slow(co_mtx_t *m) {
+    int spin = MTX_SPIN_COUNT;
+    uint64_t since = 0;
+    uintptr_t token;
+    unsigned int state = atomic_load_explicit(&m->state, memory_order_relaxed);
 
-    // need exclusive access to re-check 'held' then manipulate 'blocking'
-    // based on the CAS result:
-    int zero = 0;
-    SPIN_LOCK(m);
+    while (1) {
+        // try to acquire the lock (even if fibers are parked):
+        if (!(state & MTX_LOCKED)) {
+            if (atomic_compare_exchange_weak_explicit(&m->state, &state, state | MTX_LOCKED,
+                        memory_order_acquire, memory_order_relaxed)) {
+                return 0;
+            }
+            continue;
+        }
 
-    // must loop because a wakeup may be concurrential (e.g. co_cond_broadcast)
-    // and another lock/trylock already acquired the lock:
-    while (!atomic_compare_exchange_strong(&m->held, &zero, 1)) {
-        // push current fiber to blocking list:
-        current->m_next = NULL;
+        // no fiber is parked: retry a few times before parking:
+        if (!(state & MTX_PARKED) && spin) {
+            spin--;
+            state = atomic_load_explicit(&m->state, memory_order_relaxed);
+            continue;
+        }
 
-        if (!m->blocking.head) {
-            m->blocking.tail = m->blocking.head = current;
-        } else {
-            m->blocking.tail = m->blocking.tail->m_next = current;
+        // tell unlock that a fiber is parked:
+        if (!(state & MTX_PARKED)) {
+            if (!atomic_compare_exchange_weak_explicit(&m->state, &state, state | MTX_PARKED,
+                        memory_order_relaxed, memory_order_relaxed)) {
+                continue;
+            }
         }
 
-        // release exclusive access while current fiber is suspended:
-        SPIN_UNLOCK(m);
-        co_suspend();
+        // park until unlock wakes us up, remembering when we first blocked
+        // (across retries) to detect starvation:
+        if (!since) since = mtx_now();
+
+        int parked = parking_lot_park(m, mtx_validate, NULL, m, since, &token);
+
+        // the parked bit may be left set, and merely costs a useless unpark:
+        if (parked < 0) return ECANCELED;
 
-        // need exclusive access (again):
-        zero = 0;
-        SPIN_LOCK(m);
+        // lock was handed over: we own it already:
+        if (parked && (token & PARKING_TOKEN_HANDOFF)) return 0;
+
+        // loop to try again:
+        spin = MTX_SPIN_COUNT;
+        state = atomic_load_explicit(&m->state, memory_order_relaxed);
     }
+}
 
-    // done.
-    SPIN_UNLOCK(m);
-    LOG("%p: co_mtx_lock (acquired=wakeup)\n", (void *)m);
-    return 0;
+int co_mtx_lock(co_mtx_t *m) {
+    LOG("%p: co_mtx_lock\n", (void *)m);
+
+    // fast path (uncontended):
+    unsigned int unlocked = 0;
+    if (atomic_compare_exchange_weak_explicit(&m->state, &unlocked, MTX_LOCKED,
+                memory_order_acquire, memory_order_relaxed)) {
+        return 0;
+    }
+    return mtx_lock_slow(m);
+}
+
+void co_mtx_lock_nocancel(co_mtx_t *m) {
+    if (co_mtx_lock(m)) {
+        co_cancel_t *cancel = co_set_cancel(NULL);
+        co_mtx_lock(m);
+        co_set_cancel(cancel);
+    }
 }
 
 int co_mtx_trylock(co_mtx_t *m) {
-    //LOG("%p: co_mtx_trylock\n", (void *)m);
-    // try to acquire the lock, without exclusive access because we don't
-    // manipulate 'blocking' based on 'held' result.
-    int zero = 0;
-    if (atomic_compare_exchange_strong(&m->held, &zero, 1)) {
-        //LOG("%p: co_mtx_trylock (acquired)\n", (void *)m);
-        return 0;
+    unsigned int state = atomic_load_explicit(&m->state, memory_order_relaxed);
+
+    while (!(state & MTX_LOCKED)) {
+        if (atomic_compare_exchange_weak_explicit(&m->state, &state, state | MTX_LOCKED,
+                    memory_order_acquire, memory_order_relaxed)) {
+            return 0;
+        }
     }
-    //LOG("%p: co_mtx_trylock (failed)\n", (void *)m);
     return -1;
 }
 
+static uintptr_t mtx_unpark(void *data, parking_waiter_t *waiter, int have_more) {
+    co_mtx_t *m = data;
+
+    // starving fiber: keep the lock held and hand it over (the unparked fiber
+    // will run next on the current scheduler). Fibers requeued from a
+    // condition variable have no timestamp: they'll get one if they must park
+    // again in co_mtx_lock.
+    if (waiter && waiter->timestamp &&
+            mtx_now() - waiter->timestamp > MTX_STARVATION_THRESHOLD) {
+        if (!have_more) {
+            atomic_store_explicit(&m->state, MTX_LOCKED, memory_order_release);
+        }
+        return PARKING_TOKEN_HANDOFF;
+    }
+
+    // release the lock, keeping the parked bit if more fibers are parked
+    // (nobody else can change the state while it's locked and parked):
+    atomic_store_explicit(&m->state, have_more ? MTX_PARKED : 0, memory_order_release);
+    return 0;
+}
+
 void co_mtx_unlock(co_mtx_t *m) {
     LOG("%p: co_mtx_unlock\n", (void *)m);
-    // need exclusive access because we modify both 'held' and 'blocking' that
-    // could introduce a race condition with lock:
-    SPIN_LOCK(m);
-
-    // removes the lock (assuming the current fiber holds the lock):
-    m->held = 0;
-
-    // wakeup next blocking fiber (if any):
-    fiber_t *fiber = m->blocking.head;
-    if (fiber) {
-        m->blocking.head = fiber->m_next;
-        SPIN_UNLOCK(m);
-        co_enqueue(fiber);
-    } else {
-        SPIN_UNLOCK(m);
+
+    // fast path (no parked fiber):
+    unsigned int locked = MTX_LOCKED;
+    if (atomic_compare_exchange_strong_explicit(&m->state, &locked, 0,
+                memory_order_release, memory_order_relaxed)) {
+        return;
     }
+
+    // wakeup next parked fiber:
+    parking_lot_unpark_one(m, mtx_unpark, m);
+}
+
+// Sets the parked bit, but only if the mutex is locked. Must be called with
+// the mutex's parking lot bucket locked.
+static int mtx_mark_parked_if_locked(co_mtx_t *m) {
+    unsigned int state = atomic_load_explicit(&m->state, memory_order_relaxed);
+
+    while (state & MTX_LOCKED) {
+        if (atomic_compare_exchange_weak_explicit(&m->state, &state, state | MTX_PARKED,
+                    memory_order_relaxed, memory_order_relaxed)) {
+            return 1;
+        }
+    }
+    return 0;
 }
 
 void co_cond_init(co_cond_t *c) {
-    c->busy = (atomic_flag)ATOMIC_FLAG_INIT;
-    c->waiting.head = NULL;
-    c->waiting.tail = NULL;
+    atomic_init(&c->mutex, NULL);
+}
+
+// Fibers waiting on a condition variable park on the condition's address.
+// Signal and broadcast move them straight to the mutex's wait queue when the
+// mutex is locked (wait morphing), instead of resuming fibers that would
+// immediately block on the mutex again.
+
+struct cond_wait {
+    co_cond_t *cond;
+    co_mtx_t *mutex;
+};
+
+static int cond_validate(void *data) {
+    struct cond_wait *w = data;
+    atomic_store_explicit(&w->cond->mutex, w->mutex, memory_order_relaxed);
+    return 1;
 }
 
-void co_cond_wait(co_cond_t *restrict c, co_mtx_t *restrict m) {
+static void cond_before_sleep(void *data) {
+    // release mutex lock once the current fiber is in the wait queue, so a
+    // signal can't be missed (the fiber can't be resumed before, since
+    // signals requeue it to the locked mutex):
+    struct cond_wait *w = data;
+    co_mtx_unlock(w->mutex);
+}
+
+int co_cond_wait(co_cond_t *restrict c, co_mtx_t *restrict m) {
     LOG("%p: co_cond_wait(%p)\n", (void *)c, (void *)m);
-    // assert(m->held);
-    fiber_t *current = co_current();
-
-    // need exclusive access to manipulate wait list:
-    SPIN_LOCK(c);
-
-    // queue current fiber into wait list:
-    current->m_next = NULL;
-    if (!c->waiting.head) {
-        c->waiting.tail = c->waiting.head = current;
-    } else {
-        c->waiting.tail = c->waiting.tail->m_next = current;
+    uintptr_t token = 0;
+
+    // park (releasing the mutex) until signaled:
+    struct cond_wait w = { c, m };
+    int parked = parking_lot_park(c, cond_validate, cond_before_sleep, &w, 0, &token);
+
+    if (parked < 0) {
+        // cancelled while parked: the mutex has been released (or is about
+        // to be) and must be held on return, so lock it without being
+        // cancellable; otherwise we never released it:
+        if (token == PARKING_TOKEN_CANCELLED) {
+            co_mtx_lock_nocancel(m);
+        }
+        return ECANCELED;
     }
-    SPIN_UNLOCK(c);
 
-    // release mutex lock, enqueueing a blocked fiber:
-    // must always succeed (because current fiber holds the lock):
-    co_mtx_unlock(m);
+    // the lock was handed over (requeued to the mutex then unparked):
+    if (token & PARKING_TOKEN_HANDOFF) return 0;
 
-    // suspend execution of current fiber:
-    co_suspend();
+    // must re-acquire the mutex lock to continue (even if cancelled in the
+    // meantime: the mutex must be held on return):
+    co_mtx_lock_nocancel(m);
+    return 0;
+}
 
-    // must re-acquire the mutex lock to continue:
-    co_mtx_lock(m);
+static parking_requeue_op_t cond_signal_validate(void *data) {
+    co_cond_t *c = data;
+    co_mtx_t *m = atomic_load_explicit(&c->mutex, memory_order_relaxed);
+    if (!m) return PARKING_REQUEUE_ABORT;
+
+    // the mutex is locked (usually by the signaling fiber): requeue the
+    // fiber, that will be unparked on unlock; otherwise unpark it:
+    return mtx_mark_parked_if_locked(m) ? PARKING_REQUEUE_ONE : PARKING_UNPARK_ONE;
+}
+
+static uintptr_t cond_signal_callback(void *data, parking_requeue_op_t op, int unparked, int requeued, int have_more) {
+    co_cond_t *c = data;
+    (void)op;
+    (void)unparked;
+    (void)requeued;
+
+    if (!have_more) {
+        atomic_store_explicit(&c->mutex, NULL, memory_order_relaxed);
+    }
+    return 0;
 }
 
 void co_cond_signal(co_cond_t *c) {
     LOG("%p: co_cond_signal\n", (void *)c);
-    // need exclusive access to manipulate wait list:
-    SPIN_LOCK(c);
-
-    // enqueue next waiting fiber (if any):
-    fiber_t *fiber = c->waiting.head;
-    if (fiber) {
-        c->waiting.head = fiber->m_next;
-        SPIN_UNLOCK(c);
-
-        // TODO: or co_resume(fiber) ?
-        co_enqueue(fiber);
-    } else {
-        SPIN_UNLOCK(c);
+
+    // nothing to do (the mutex is expected to be held, so any waiter would
+    // have been visible):
+    co_mtx_t *m = atomic_load_explicit(&c->mutex, memory_order_relaxed);
+    if (!m) return;
+
+    parking_lot_unpark_requeue(c, m, cond_signal_validate, cond_signal_callback, c);
+}
+
+static parking_requeue_op_t cond_broadcast_validate(void *data) {
+    struct cond_wait *w = data;
+    co_mtx_t *m = atomic_load_explicit(&w->cond->mutex, memory_order_relaxed);
+    if (!m) return PARKING_REQUEUE_ABORT;
+
+    // all waiters are leaving:
+    atomic_store_explicit(&w->cond->mutex, NULL, memory_order_relaxed);
+
+    // the mutex is locked: requeue all fibers, otherwise unpark one fiber
+    // that will lock the mutex, and requeue the others:
+    return mtx_mark_parked_if_locked(m) ? PARKING_REQUEUE_ALL : PARKING_UNPARK_ONE_REQUEUE_REST;
+}
+
+static uintptr_t cond_broadcast_callback(void *data, parking_requeue_op_t op, int unparked, int requeued, int have_more) {
+    struct cond_wait *w = data;
+    (void)unparked;
+    (void)have_more;
+
+    // requeued fibers must be unparked on unlock:
+    if (op == PARKING_UNPARK_ONE_REQUEUE_REST && requeued) {
+        atomic_fetch_or_explicit(&w->mutex->state, MTX_PARKED, memory_order_relaxed);
     }
+    return 0;
 }
 
 void co_cond_broadcast(co_cond_t *c) {
     LOG("%p: co_cond_broadcast\n", (void *)c);
-    SPIN_LOCK(c);
 
-    // enqueue all waiting fibers:
-    fiber_t *fiber = c->waiting.head;
-    while (fiber) {
-        co_enqueue(fiber);
-        fiber = fiber->m_next;
-    }
+    co_mtx_t *m = atomic_load_explicit(&c->mutex, memory_order_relaxed);
+    if (!m) return;
 
-    // clear linked list:
-    c->waiting.head = NULL;
-    SPIN_UNLOCK(c);
+    struct cond_wait w = { c, m };
+    parking_lot_unpark_requeue(c, m, cond_broadcast_validate, cond_broadcast_callback, &w);
 }
 
 #endif
@@ -0,0 +1,147 @@
+#include "muco.h"
+#include "muco/parallel.h"
+#include "config.h"
+
+#include <errno.h>
+#include <error.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Lazy binary splitting, as in "Lazy Binary-Splitting: A Run-Time Adaptive
+// Work-Stealing Scheduler" (2010): a range is only split when the local queue
+// holds less than CO_PARALLEL_SPLIT fibers.
+//
+// A fork resumes a fiber for the upper half of the range immediately, while
+// the forking fiber (with the lower half) is enqueued, where thieves may steal
+// it (see co_spawn_now). Each range keeps a list of its forks, to combine
+// their accumulators in order once they all completed.
+
+#ifndef CO_PARALLEL_SPLIT
+#define CO_PARALLEL_SPLIT (1)
+#endif
+
+typedef struct {
+    size_t grain;
+    size_t size;
+    const void *identity;
+    co_reduce_fn_t fn;
+    co_combine_fn_t combine;
+    void *ctx;
+} parallel_t;
+
+// Waits for the forks of a range: counts the forks + 1 (the forking fiber).
+typedef struct {
+    atomic_long pending;
+    fiber_t *waiter;
+} parallel_join_t;
+
+typedef struct parallel_fork {
+    parallel_t *loop;
+    size_t begin;
+    size_t end;
+    parallel_join_t *join;
+    struct parallel_fork *next;
+    _Alignas(max_align_t) unsigned char acc[];
+} parallel_fork_t;
+
+static void parallel_run(parallel_t *loop, size_t begin, size_t end, void *acc);
+
+// The fork being spawned: a fork starts immediately on the forking thread,
+// and reads it before anything else may run on the thread, and before it may
+// switch (so the thread-local address can't go stale).
+static CO_TLS parallel_fork_t *parallel_handoff;
+
+static void parallel_join_release(parallel_join_t *join) {
+    if (atomic_fetch_sub(&join->pending, 1) == 1) {
+        co_enqueue(join->waiter);
+    }
+}
+
+static void parallel_join_action(void *data) {
+    parallel_join_release((parallel_join_t *)data);
+}
+
+static void parallel_join_wait(parallel_join_t *join) {
+    if (atomic_load(&join->pending) == 1) return;
+
+    // the waiter is set before releasing our own count, so the last fork
+    // always sees it:
+    join->waiter = co_current();
+    co_suspend_then(parallel_join_action, join);
+}
+
+static void parallel_fork_main() {
+    parallel_fork_t *fork = parallel_handoff;
+    parallel_run(fork->loop, fork->begin, fork->end, fork->acc);
+    parallel_join_release(fork->join);
+}
+
+static void parallel_run(parallel_t *loop, size_t begin, size_t end, void *acc) {
+    parallel_join_t join = { 1, NULL };
+    parallel_fork_t *forks = NULL;
+    int split = co_nprocs() > 1 && co_current() != co_main();
+
+    while (begin < end) {
+        size_t n = end - begin;
+
+        if (split && n > loop->grain && co_queue_size() < CO_PARALLEL_SPLIT) {
+            parallel_fork_t *fork = malloc(sizeof(parallel_fork_t) + loop->size);
+            if (fork == NULL) {
+                error(1, errno, "malloc");
+            }
+            fork->loop = loop;
+            fork->begin = begin + n / 2;
+            fork->end = end;
+            fork->join = &join;
+            fork->next = forks;
+            if (loop->size) memcpy(fork->acc, loop->identity, loop->size);
+            forks = fork;
+            end = fork->begin;
+
+            atomic_fetch_add(&join.pending, 1);
+            parallel_handoff = fork;
+            co_spawn_now(parallel_fork_main);
+            continue;
+        }
+
+        size_t stop = n > loop->grain ? begin + loop->grain : end;
+        loop->fn(begin, stop, acc, loop->ctx);
+        begin = stop;
+    }
+
+    if (!forks) return;
+    parallel_join_wait(&join);
+
+    // the latest fork is the next range, and so on:
+    while (forks) {
+        parallel_fork_t *fork = forks;
+        if (loop->combine) loop->combine(acc, fork->acc, loop->ctx);
+        forks = fork->next;
+        free(fork);
+    }
+}
+
+void co_parallel_reduce(size_t begin, size_t end, size_t grain,
+        void *acc, size_t size, const void *identity,
+        co_reduce_fn_t fn, co_combine_fn_t combine, void *ctx
+) {
+    parallel_t loop = { grain ? grain : 1, size, identity, fn, combine, ctx };
+    parallel_run(&loop, begin, end, acc);
+}
+
+struct parallel_for {
+    co_parallel_fn_t fn;
+    void *ctx;
+};
+
+static void parallel_for_body(size_t begin, size_t end, void *acc, void *ctx) {
+    (void)acc;
+    struct parallel_for *body = ctx;
+    body->fn(begin, end, body->ctx);
+}
+
+void co_parallel_for(size_t begin, size_t end, size_t grain, co_parallel_fn_t fn, void *ctx) {
+    struct parallel_for body = { fn, ctx };
+    co_parallel_reduce(begin, end, grain, NULL, 0, NULL, parallel_for_body, NULL, &body);
+}
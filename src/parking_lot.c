@@ -0,0 +1,327 @@
+#include "muco.h"
+#include "muco/join.h"
+#include "parking_lot.h"
+
+#include <stdatomic.h>
+#include "spin.h"
+
+#define PARKING_LOT_BITS (10)
+#define PARKING_LOT_SIZE (1 << PARKING_LOT_BITS)
+
+typedef struct {
+    _Alignas(64) spin_t busy;
+    parking_waiter_t *head;
+    parking_waiter_t *tail;
+} parking_bucket_t;
+
+static parking_bucket_t parking_lot[PARKING_LOT_SIZE];
+
+static inline parking_bucket_t *parking_lot_bucket(const void *addr) {
+    // fibonacci hashing:
+    uint64_t h = ((uintptr_t)addr >> 3) * 0x9E3779B97F4A7C15ULL;
+    return &parking_lot[h >> (64 - PARKING_LOT_BITS)];
+}
+
+struct parking_sleep {
+    parking_bucket_t *bucket;
+    parking_before_sleep_t before_sleep;
+    void *data;
+};
+
+static void parking_lot_sleep(void *arg) {
+    // the fiber may be unparked as soon as the bucket is unlocked, which would
+    // invalidate `arg` (on its stack):
+    struct parking_sleep sleep = *(struct parking_sleep *)arg;
+    spin_unlock(&sleep.bucket->busy);
+
+    if (sleep.before_sleep) {
+        sleep.before_sleep(sleep.data);
+    }
+}
+
+int parking_lot_park(const void *addr, parking_validate_t validate,
+        parking_before_sleep_t before_sleep, void *data, uint64_t timestamp,
+        uintptr_t *token
+) {
+    parking_bucket_t *bucket = parking_lot_bucket(addr);
+    spin_lock(&bucket->busy);
+
+    // checked with the bucket locked, so either co_cancel sees the waiter, or
+    // we see the cancellation:
+    if (co_cancelled()) {
+        spin_unlock(&bucket->busy);
+        return -1;
+    }
+
+    if (validate && !validate(data)) {
+        spin_unlock(&bucket->busy);
+        return 0;
+    }
+
+    // the waiter lives on the stack of the parked fiber, that won't be
+    // unwound until the fiber is resumed:
+    parking_waiter_t waiter = { co_current(), addr, timestamp, 0, NULL };
+
+    if (bucket->head) {
+        bucket->tail = bucket->tail->next = &waiter;
+    } else {
+        bucket->tail = bucket->head = &waiter;
+    }
+
+    // keep the bucket locked until the fiber has been switched out, so it
+    // can't be unparked (and resumed) before its context is saved:
+    struct parking_sleep sleep = { bucket, before_sleep, data };
+    co_suspend_then(parking_lot_sleep, &sleep);
+
+    if (token) {
+        *token = waiter.token;
+    }
+    return waiter.token == PARKING_TOKEN_CANCELLED ? -1 : 1;
+}
+
+int parking_lot_unpark_one(const void *addr, parking_unpark_t callback, void *data) {
+    parking_bucket_t *bucket = parking_lot_bucket(addr);
+    spin_lock(&bucket->busy);
+
+    parking_waiter_t *prev = NULL;
+    parking_waiter_t *waiter = bucket->head;
+
+    while (waiter && waiter->addr != addr) {
+        prev = waiter;
+        waiter = waiter->next;
+    }
+
+    if (!waiter) {
+        if (callback) callback(data, NULL, 0);
+        spin_unlock(&bucket->busy);
+        return 0;
+    }
+
+    // unlink waiter:
+    if (prev) {
+        prev->next = waiter->next;
+    } else {
+        bucket->head = waiter->next;
+    }
+    if (bucket->tail == waiter) {
+        bucket->tail = prev;
+    }
+
+    // are there more fibers parked on the same address?
+    int have_more = 0;
+    for (parking_waiter_t *w = waiter->next; w; w = w->next) {
+        if (w->addr == addr) {
+            have_more = 1;
+            break;
+        }
+    }
+
+    uintptr_t token = callback ? callback(data, waiter, have_more) : 0;
+    waiter->token = token;
+    fiber_t *fiber = waiter->fiber;
+    spin_unlock(&bucket->busy);
+
+    // the waiter may be invalid as soon as the fiber is resumed:
+    if (token & PARKING_TOKEN_HANDOFF) {
+        co_enqueue_next(fiber);
+    } else {
+        co_enqueue(fiber);
+    }
+    return 1;
+}
+
+int parking_lot_unpark_all(const void *addr, uintptr_t token) {
+    parking_bucket_t *bucket = parking_lot_bucket(addr);
+    struct { parking_waiter_t *head, *tail; } list = { NULL, NULL };
+    int count = 0;
+
+    spin_lock(&bucket->busy);
+
+    // move all matching waiters into a local list:
+    parking_waiter_t **link = &bucket->head;
+    parking_waiter_t *prev = NULL;
+
+    while (*link) {
+        parking_waiter_t *waiter = *link;
+
+        if (waiter->addr == addr) {
+            *link = waiter->next;
+            waiter->next = NULL;
+            waiter->token = token;
+
+            if (list.head) {
+                list.tail = list.tail->next = waiter;
+            } else {
+                list.tail = list.head = waiter;
+            }
+            count++;
+        } else {
+            prev = waiter;
+            link = &waiter->next;
+        }
+    }
+    bucket->tail = prev;
+
+    spin_unlock(&bucket->busy);
+
+    // chain fibers (waiters may be invalid as soon as their fiber is resumed)
+    // then enqueue them all at once:
+    fiber_t *head = NULL, *tail = NULL;
+
+    for (parking_waiter_t *waiter = list.head; waiter; waiter = waiter->next) {
+        waiter->fiber->m_next = NULL;
+        if (head) {
+            tail = tail->m_next = waiter->fiber;
+        } else {
+            tail = head = waiter->fiber;
+        }
+    }
+    co_enqueue_list(head);
+
+    return count;
+}
+
+int parking_lot_cancel(parking_match_t match, void *data) {
+    fiber_t *head = NULL, *tail = NULL;
+    int count = 0;
+
+    for (int i = 0; i < PARKING_LOT_SIZE; i++) {
+        parking_bucket_t *bucket = &parking_lot[i];
+        spin_lock(&bucket->busy);
+
+        parking_waiter_t **link = &bucket->head;
+        parking_waiter_t *prev = NULL;
+
+        while (*link) {
+            parking_waiter_t *waiter = *link;
+
+            if (match(waiter->fiber, data)) {
+                *link = waiter->next;
+                waiter->token = PARKING_TOKEN_CANCELLED;
+
+                // the waiter may be invalid as soon as the fiber is resumed:
+                fiber_t *fiber = waiter->fiber;
+                fiber->m_next = NULL;
+                if (head) {
+                    tail = tail->m_next = fiber;
+                } else {
+                    tail = head = fiber;
+                }
+                count++;
+            } else {
+                prev = waiter;
+                link = &waiter->next;
+            }
+        }
+        bucket->tail = prev;
+
+        spin_unlock(&bucket->busy);
+    }
+
+    if (head) co_enqueue_list(head);
+    return count;
+}
+
+static void parking_lot_lock_pair(parking_bucket_t *a, parking_bucket_t *b) {
+    // always lock buckets in the same order to avoid deadlocks:
+    if (a == b) {
+        spin_lock(&a->busy);
+    } else if (a < b) {
+        spin_lock(&a->busy);
+        spin_lock(&b->busy);
+    } else {
+        spin_lock(&b->busy);
+        spin_lock(&a->busy);
+    }
+}
+
+static void parking_lot_unlock_pair(parking_bucket_t *a, parking_bucket_t *b) {
+    spin_unlock(&a->busy);
+    if (a != b) {
+        spin_unlock(&b->busy);
+    }
+}
+
+int parking_lot_unpark_requeue(const void *from, const void *to,
+        parking_requeue_validate_t validate, parking_requeue_callback_t callback,
+        void *data
+) {
+    parking_bucket_t *source = parking_lot_bucket(from);
+    parking_bucket_t *target = parking_lot_bucket(to);
+    parking_lot_lock_pair(source, target);
+
+    parking_requeue_op_t op = validate(data);
+    if (op == PARKING_REQUEUE_ABORT) {
+        parking_lot_unlock_pair(source, target);
+        return 0;
+    }
+
+    parking_waiter_t *wakeup = NULL;
+    struct { parking_waiter_t *head, *tail; } list = { NULL, NULL };
+    int requeued = 0, have_more = 0;
+
+    parking_waiter_t **link = &source->head;
+    parking_waiter_t *prev = NULL;
+
+    while (*link) {
+        parking_waiter_t *waiter = *link;
+
+        if (waiter->addr != from) {
+            prev = waiter;
+            link = &waiter->next;
+            continue;
+        }
+
+        if (!wakeup && !requeued &&
+                (op == PARKING_UNPARK_ONE || op == PARKING_UNPARK_ONE_REQUEUE_REST)) {
+            wakeup = waiter;
+        } else if (op == PARKING_REQUEUE_ALL || op == PARKING_UNPARK_ONE_REQUEUE_REST ||
+                (op == PARKING_REQUEUE_ONE && !requeued)) {
+            waiter->addr = to;
+            if (list.head) {
+                list.tail = list.tail->next = waiter;
+            } else {
+                list.tail = list.head = waiter;
+            }
+            requeued++;
+        } else {
+            // leave remaining waiters in place:
+            have_more = 1;
+            break;
+        }
+
+        // unlink waiter:
+        *link = waiter->next;
+    }
+    if (!*link) {
+        source->tail = prev;
+    }
+
+    // append requeued waiters to the target wait queue:
+    if (list.head) {
+        list.tail->next = NULL;
+        if (target->head) {
+            target->tail->next = list.head;
+        } else {
+            target->head = list.head;
+        }
+        target->tail = list.tail;
+    }
+
+    uintptr_t token = callback ? callback(data, op, wakeup != NULL, requeued, have_more) : 0;
+    fiber_t *fiber = NULL;
+    if (wakeup) {
+        wakeup->token = token;
+        fiber = wakeup->fiber;
+    }
+    parking_lot_unlock_pair(source, target);
+
+    if (fiber) {
+        if (token & PARKING_TOKEN_HANDOFF) {
+            co_enqueue_next(fiber);
+        } else {
+            co_enqueue(fiber);
+        }
+    }
+    return (fiber != NULL) + requeued;
+}
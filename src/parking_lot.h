@@ -0,0 +1,101 @@
+#ifndef MUCO_PARKING_LOT_PRIV_H
+#define MUCO_PARKING_LOT_PRIV_H
+
+// Global table of wait queues, hashed by address.
+//
+// Synchronization primitives don't have to hold their own list of blocked
+// fibers (and a spin lock to protect it): they park fibers on their own
+// address, and only need a few bits of state (e.g. locked and has-parked) to
+// decide whether a fiber must be parked or unparked. The table is shared by
+// all primitives, each bucket being protected by its own spin lock.
+//
+// Based on:
+//
+// - "Locking in WebKit" (2016) by Filip Pizlo.
+// - The parking_lot crate for Rust, by Amanieu d'Antras.
+
+#include <stdint.h>
+
+// only declares the fiber type (the header is shared with the scheduler):
+typedef struct fiber fiber_t;
+
+typedef struct parking_waiter {
+    fiber_t *fiber;
+    const void *addr;
+    uint64_t timestamp;
+    uintptr_t token;
+    struct parking_waiter *next;
+} parking_waiter_t;
+
+// Unparking with this token bit set hands something over (e.g. a lock) to the
+// unparked fiber, that is then enqueued to run next on the current scheduler.
+#define PARKING_TOKEN_HANDOFF ((uintptr_t)1)
+
+// Token of the fibers unparked because they have been cancelled.
+#define PARKING_TOKEN_CANCELLED ((uintptr_t)2)
+
+// Called with the bucket locked; the fiber is parked only if it returns true.
+typedef int (*parking_validate_t)(void *data);
+
+// Called after the fiber has been queued and suspended, once the bucket has
+// been unlocked. The fiber may already be unparked, so `data` musn't be
+// accessed anymore once the callback released whatever the fiber waits for.
+typedef void (*parking_before_sleep_t)(void *data);
+
+// Called with the bucket locked, after a fiber has been dequeued (`waiter` is
+// NULL if there was none), with whether fibers are still parked on the
+// address. Returns the token to pass to the unparked fiber.
+typedef uintptr_t (*parking_unpark_t)(void *data, parking_waiter_t *waiter, int have_more);
+
+// Parks the current fiber on `addr`. Returns 1 once the fiber has been
+// unparked, setting `token` to the value passed by the unparker, or 0 when
+// `validate` failed and the fiber wasn't parked. The timestamp is opaque to
+// the parking lot, and merely available to unpark callbacks. Returns -1 when
+// the fiber has been cancelled (see co_cancel): either before it parked, or
+// while it was parked (`token` is then set to PARKING_TOKEN_CANCELLED).
+// Beware that a cancelled fiber may be resumed before (or while)
+// `before_sleep` runs: `data` must stay valid until the caller has
+// synchronized with whatever `before_sleep` releases (e.g. relocked a mutex).
+int parking_lot_park(const void *addr, parking_validate_t validate,
+        parking_before_sleep_t before_sleep, void *data, uint64_t timestamp,
+        uintptr_t *token);
+
+// Unparks the first fiber parked on `addr` (if any). Returns 1 when a fiber
+// was unparked.
+int parking_lot_unpark_one(const void *addr, parking_unpark_t callback, void *data);
+
+// Unparks all the fibers parked on `addr`, and returns how many they were.
+int parking_lot_unpark_all(const void *addr, uintptr_t token);
+
+// Unparks the fibers parked on any address for which `match` returns true,
+// with the PARKING_TOKEN_CANCELLED token. Walks the whole table, locking one
+// bucket at a time. Returns how many fibers were unparked.
+typedef int (*parking_match_t)(fiber_t *fiber, void *data);
+int parking_lot_cancel(parking_match_t match, void *data);
+
+typedef enum {
+    PARKING_REQUEUE_ABORT = 0,
+    PARKING_UNPARK_ONE,
+    PARKING_REQUEUE_ONE,
+    PARKING_UNPARK_ONE_REQUEUE_REST,
+    PARKING_REQUEUE_ALL,
+} parking_requeue_op_t;
+
+// Called with both buckets locked; decides what to do with the fibers.
+typedef parking_requeue_op_t (*parking_requeue_validate_t)(void *data);
+
+// Called with both buckets locked, after fibers have been moved, with whether
+// fibers are still parked on the `from` address. Returns the token to pass to
+// the unparked fiber (if any).
+typedef uintptr_t (*parking_requeue_callback_t)(void *data, parking_requeue_op_t op,
+        int unparked, int requeued, int have_more);
+
+// Unparks and/or moves fibers parked on `from` to the wait queue of `to`
+// (without resuming them), as decided by `validate`. For example a condition
+// variable moves its waiters to the mutex, so they're only resumed once they
+// may actually lock it. Returns the number of fibers unparked or requeued.
+int parking_lot_unpark_requeue(const void *from, const void *to,
+        parking_requeue_validate_t validate, parking_requeue_callback_t callback,
+        void *data);
+
+#endif
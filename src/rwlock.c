@@ -0,0 +1,198 @@
+#include "muco.h"
+#include "muco/rwlock.h"
+#include "parking_lot.h"
+
+#include <errno.h>
+#include <error.h>
+#include <stdlib.h>
+
+// state bits:
+#define RW_WRITER (1U)   // readers must wait (writer holds or waits for the lock)
+#define RW_DRAINING (2U) // a writer is parked, waiting for readers to leave
+#define RW_PARKED (4U)   // readers are parked, waiting for the writer to leave
+
+// Readers increment their counter *then* check for a writer, while writers
+// set the writer bit *then* sum the counters, both sequentially consistent,
+// so at least one of them sees the other.
+//
+// Readers park on the address of `state` and writers (waiting for readers to
+// leave) park on the address of `readers`.
+
+void co_rwlock_init(co_rwlock_t *rw, co_rwlock_kind_t kind) {
+    atomic_init(&rw->state, 0);
+    rw->kind = kind;
+    atomic_init(&rw->owner, NULL);
+    co_mtx_init(&rw->writer);
+
+    int maxprocs = co_maxprocs();
+    rw->nslots = maxprocs > 0 ? maxprocs : 1;
+    rw->readers = aligned_alloc(sizeof(co_rwlock_slot_t), sizeof(co_rwlock_slot_t) * rw->nslots);
+    if (rw->readers == NULL) {
+        error(1, errno, "aligned_alloc");
+    }
+    for (int i = 0; i < rw->nslots; i++) {
+        atomic_init(&rw->readers[i].count, 0);
+    }
+}
+
+void co_rwlock_destroy(co_rwlock_t *rw) {
+    free(rw->readers);
+}
+
+static inline atomic_long *rwlock_slot(co_rwlock_t *rw) {
+    return &rw->readers[co_scheduler_id() % rw->nslots].count;
+}
+
+// A reader may lock on a scheduler then unlock on another one (fibers may be
+// stolen) so a single counter may be negative, but the sum is always exact.
+static long rwlock_readers(co_rwlock_t *rw) {
+    long sum = 0;
+    for (int i = 0; i < rw->nslots; i++) {
+        sum += atomic_load(&rw->readers[i].count);
+    }
+    return sum;
+}
+
+static void rwlock_read_leave(co_rwlock_t *rw, atomic_long *slot) {
+    atomic_fetch_sub(slot, 1);
+
+    // wakeup the writer waiting for readers to leave (if any), once the last
+    // reader left; the writer re-checks the sum, so a spurious wakeup is
+    // harmless, while the last reader to leave always sees the sum drop to
+    // zero:
+    if ((atomic_load(&rw->state) & RW_DRAINING) && rwlock_readers(rw) == 0) {
+        parking_lot_unpark_one(&rw->readers, NULL, NULL);
+    }
+}
+
+static int rwlock_reader_validate(void *data) {
+    co_rwlock_t *rw = data;
+    unsigned int state = atomic_load(&rw->state);
+    return (state & RW_WRITER) && (state & RW_PARKED);
+}
+
+static int rwlock_reader_wait(co_rwlock_t *rw) {
+    unsigned int state = atomic_load(&rw->state);
+
+    while (state & RW_WRITER) {
+        if (state & RW_PARKED) {
+            return parking_lot_park(&rw->state, rwlock_reader_validate, NULL, rw, 0, NULL);
+        }
+        atomic_compare_exchange_weak(&rw->state, &state, state | RW_PARKED);
+    }
+    return 0;
+}
+
+int co_rwlock_rdlock(co_rwlock_t *rw) {
+    while (1) {
+        atomic_long *slot = rwlock_slot(rw);
+        atomic_fetch_add(slot, 1);
+
+        if (!(atomic_load(&rw->state) & RW_WRITER)) {
+            return 0;
+        }
+
+        // a writer holds (or waits for) the lock: back off, then wait:
+        rwlock_read_leave(rw, slot);
+        if (rwlock_reader_wait(rw) < 0) return ECANCELED;
+    }
+}
+
+int co_rwlock_tryrdlock(co_rwlock_t *rw) {
+    atomic_long *slot = rwlock_slot(rw);
+    atomic_fetch_add(slot, 1);
+
+    if (!(atomic_load(&rw->state) & RW_WRITER)) {
+        return 0;
+    }
+
+    rwlock_read_leave(rw, slot);
+    return -1;
+}
+
+static int rwlock_writer_validate(void *data) {
+    co_rwlock_t *rw = data;
+    return (atomic_load(&rw->state) & RW_DRAINING) && rwlock_readers(rw) != 0;
+}
+
+static int rwlock_wait_readers(co_rwlock_t *rw) {
+    int cancelled = 0;
+
+    while (rwlock_readers(rw) != 0) {
+        atomic_fetch_or(&rw->state, RW_DRAINING);
+        if (parking_lot_park(&rw->readers, rwlock_writer_validate, NULL, rw, 0, NULL) < 0) {
+            cancelled = 1;
+            break;
+        }
+    }
+    atomic_fetch_and(&rw->state, ~RW_DRAINING);
+    return cancelled ? -1 : 0;
+}
+
+static void rwlock_release_readers(co_rwlock_t *rw) {
+    unsigned int state = atomic_fetch_and(&rw->state, ~(RW_WRITER | RW_PARKED));
+
+    // wakeup all parked readers at once:
+    if (state & RW_PARKED) {
+        parking_lot_unpark_all(&rw->state, 0);
+    }
+}
+
+int co_rwlock_wrlock(co_rwlock_t *rw) {
+    // only one writer at a time:
+    if (co_mtx_lock(&rw->writer)) return ECANCELED;
+
+    if (rw->kind == CO_RWLOCK_PREFER_WRITER) {
+        // block new readers, then wait for current readers to leave:
+        atomic_fetch_or(&rw->state, RW_WRITER);
+        if (rwlock_wait_readers(rw) < 0) {
+            rwlock_release_readers(rw);
+            co_mtx_unlock(&rw->writer);
+            return ECANCELED;
+        }
+    } else {
+        // wait for readers to leave, then block new readers, unless some
+        // reader came in meanwhile:
+        while (1) {
+            if (rwlock_wait_readers(rw) < 0) {
+                co_mtx_unlock(&rw->writer);
+                return ECANCELED;
+            }
+            atomic_fetch_or(&rw->state, RW_WRITER);
+            if (rwlock_readers(rw) == 0) break;
+            rwlock_release_readers(rw);
+        }
+    }
+
+    atomic_store_explicit(&rw->owner, co_current(), memory_order_relaxed);
+    return 0;
+}
+
+int co_rwlock_trywrlock(co_rwlock_t *rw) {
+    if (co_mtx_trylock(&rw->writer)) {
+        return -1;
+    }
+
+    atomic_fetch_or(&rw->state, RW_WRITER);
+
+    if (rwlock_readers(rw) != 0) {
+        rwlock_release_readers(rw);
+        co_mtx_unlock(&rw->writer);
+        return -1;
+    }
+
+    atomic_store_explicit(&rw->owner, co_current(), memory_order_relaxed);
+    return 0;
+}
+
+void co_rwlock_unlock(co_rwlock_t *rw) {
+    if (atomic_load_explicit(&rw->owner, memory_order_relaxed) == co_current()) {
+        // writer:
+        atomic_store_explicit(&rw->owner, NULL, memory_order_relaxed);
+        rwlock_release_readers(rw);
+        co_mtx_unlock(&rw->writer);
+    } else {
+        // reader (may have been stolen by another scheduler since rdlock):
+        rwlock_read_leave(rw, rwlock_slot(rw));
+    }
+}
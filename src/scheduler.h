@@ -5,22 +5,139 @@
 #include "fiber.h"
 #include "queue.h"
 #include "spin.h"
+#include "parking_lot.h"
+#include "muco/join.h"
+
+#include <limits.h>
+#include <linux/futex.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+// An action is run on behalf of a fiber right after it has been switched out
+// (its context saved), by the fiber that has been switched in. This is where
+// a suspending fiber may publish itself (enqueue itself, release the lock of a
+// wait list, ...) since it can't be resumed before its context is saved.
+typedef void (*scheduler_action_t)(void *data);
+
+// A lower priority level is served first once it has been skipped that many
+// times in favor of higher levels.
+#ifndef CO_PRIORITY_AGING
+#define CO_PRIORITY_AGING 16
+#endif
+
+// A fiber woken up that many times in a row by the same fiber is considered
+// strongly coupled to it (e.g. producer/consumer), and is kept on the waker's
+// scheduler. Zero disables the tracking.
+#ifndef CO_COUPLING_THRESHOLD
+#define CO_COUPLING_THRESHOLD 8
+#endif
+
+// Idle threads only steal a coupled fiber after that many failed attempts at
+// stealing anything else (see scheduler_steal_loop).
+#ifndef CO_COUPLING_PATIENCE
+#define CO_COUPLING_PATIENCE 50
+#endif
+
+// Suspending, yielding and exiting fibers switch directly to the next runnable
+// fiber (stealing one if needed), instead of switching to the main fiber that
+// would then switch to the next runnable fiber. The main fiber only runs to
+// park the thread, or to stop the scheduler.
+#ifndef CO_DIRECT_SWITCH
+#define CO_DIRECT_SWITCH 1
+#endif
+
+// Where a woken fiber is enqueued: on the scheduler of the waker (the fiber
+// runs on the waker's thread, unless stolen), or back on its home scheduler
+// (the fiber keeps running on the same thread, with its working set in the
+// same cache). Pinned fibers always return home.
+#define SCHEDULER_WAKE_LOCAL (0)
+#define SCHEDULER_WAKE_HOME (1)
+
+// A runtime owns a set of schedulers (one thread each) with their queues and
+// stack pools, and its parking state. Fibers never leave their runtime: they
+// are only stolen by schedulers of the same runtime, and a fiber woken from
+// another runtime is sent back to its home scheduler.
+typedef struct co_runtime {
+    struct scheduler *schedulers;
+    atomic_int nprocs;  // active schedulers
+    int maxprocs;       // schedulers the runtime may grow to, 0 for a single thread
+    atomic_int started; // schedulers initialized so far (lazily, see scheduler_resize)
+    int nthreads;       // threads created so far
+    int running;
+    int wake_policy;
+
+    // parking (see scheduler_park):
+    atomic_int park_count;
+
+    // monitor (see co_runtime_wait), also protects `running` and the
+    // automatic mode:
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    int procs_auto;
+    pthread_t *threads;
+} co_runtime_t;
 
 typedef struct scheduler {
     int color;
+    co_runtime_t *runtime;
 
     fiber_t *main;
     fiber_t *current;
+    _Atomic(fiber_t *) next;
+
+    // a strongly coupled fiber, woken up by the current fiber, that should
+    // run on this thread (only stolen as a last resort):
+    _Atomic(fiber_t *) coupled;
 
-    queue_t runnables;
+    // one queue per priority level, with how many times each level has been
+    // skipped while having runnable fibers (aging):
+    queue_t runnables[FIBER_PRIORITY_LEVELS];
+    int skipped[FIBER_PRIORITY_LEVELS];
     queue_t pending;
 
+    // fibers enqueued by other threads (pushed by any thread, taken by the
+    // owner), and pinned fibers (never stolen):
+    _Atomic(fiber_t *) injected;
+    fiber_t *pinned_head;
+    fiber_t *pinned_tail;
+
+    // parking (see scheduler_park), also the futex the thread sleeps on:
+    atomic_int parked;
+
     pcg32_random_t rng;
+
+    // deferred action, run right after the next context switch:
+    scheduler_action_t action;
+    void *action_data;
+    fiber_t *yielded;
+
+    // embedding (see scheduler_run_once): fibers left to resume (-1 when not
+    // limited) and deadline (monotonic ns, 0 for none), then the eventfd (if
+    // any) and whether it has been signaled since the last run:
+    int budget;
+    uint64_t deadline;
+    int eventfd;
+    atomic_int notified;
+
+    // free chunks for the arenas of fibers (see co_arena_alloc):
+    arena_cache_t arena;
+
+    unsigned long switches;
+    unsigned long migrations;
 } scheduler_t;
 
+// Scheduler of the current thread, and its current fiber (also exposed to the
+// public co_current). Never take their addresses: a fiber may be resumed by
+// another thread, while compilers assume that the thread pointer doesn't
+// change within a function.
+extern CO_TLS scheduler_t *co_tl_scheduler;
+extern CO_TLS fiber_t *co_tl_current;
+
 #ifdef DEBUG
 #include <stdio.h>
-#include <unistd.h>
 static void LOG(char *action, scheduler_t *scheduler, fiber_t *fiber) {
     if (fiber) {
         dprintf(2, "\033[%dmthread=%lx %12s scheduler=%p fiber=%p [%s]\033[0m\n", scheduler->color, pthread_self(), action, (void *)scheduler, (void *)fiber, fiber->name);
@@ -33,37 +150,81 @@ static void LOG(char *action, scheduler_t *scheduler, fiber_t *fiber) {
 #define LOG(action, scheduler, fiber)
 #endif
 
-static int co_park_count = 0;
-static pthread_mutex_t co_park_mtx = PTHREAD_MUTEX_INITIALIZER;
-static pthread_cond_t co_park_cond = PTHREAD_COND_INITIALIZER;
-static void scheduler_park();
-static void scheduler_unpark();
+static void scheduler_park(scheduler_t *self, int surplus);
+static void scheduler_unpark(co_runtime_t *runtime, int count);
+static int scheduler_unpark_one(scheduler_t *self);
+static void scheduler_unpark_all(co_runtime_t *runtime);
+static int scheduler_surplus(scheduler_t *self);
+static int scheduler_foreign(scheduler_t *self, fiber_t *fiber);
+static void scheduler_resize(co_runtime_t *runtime, int count);
+static void scheduler_retire(scheduler_t *self);
 
-static void scheduler_initialize(scheduler_t *self, int color);
+static void scheduler_initialize(scheduler_t *self, co_runtime_t *runtime, int color);
 static void scheduler_finalize(scheduler_t *self);
 
-static fiber_t *scheduler_spawn(scheduler_t *self, fiber_main_t proc, char *name);
+static fiber_t *scheduler_spawn(scheduler_t *self, fiber_main_t proc, char *name, int priority);
+static void scheduler_spawn_now(scheduler_t *self, fiber_main_t proc, char *name);
+static void on_fiber_start();
 static void on_fiber_exit();
 static void scheduler_free_pending(scheduler_t *self, int count);
 
 static void scheduler_enqueue(scheduler_t *self, fiber_t *fiber);
+static void scheduler_push(scheduler_t *self, fiber_t *fiber);
+static int scheduler_inject(scheduler_t *self, fiber_t *fiber);
+static void scheduler_push_remote(scheduler_t *target, fiber_t *fiber);
+static void scheduler_enqueue_foreign(fiber_t *fiber);
+static void scheduler_drain(scheduler_t *self);
+static int scheduler_couple(scheduler_t *self, fiber_t *fiber);
+static void scheduler_wake(scheduler_t *self, fiber_t *fiber);
+static void scheduler_enqueue_list(scheduler_t *self, fiber_t *fiber);
+static void scheduler_enqueue_next(scheduler_t *self, fiber_t *fiber);
+static fiber_t *scheduler_pop(scheduler_t *self);
+static void scheduler_skip(scheduler_t *self, int level);
+static int scheduler_admit(scheduler_t *self, int level);
+static fiber_t *scheduler_next(scheduler_t *self);
+static fiber_t *scheduler_pick(scheduler_t *self);
+static void scheduler_switch(scheduler_t *self, fiber_t *fiber, scheduler_action_t action, void *data);
+static void scheduler_after_switch(scheduler_t *self);
 static void scheduler_resume(scheduler_t *self, fiber_t *fiber);
-static void scheduler_reschedule(scheduler_t *self);
+static void scheduler_reschedule(scheduler_t *self, scheduler_action_t action, void *data);
 static void scheduler_yield(scheduler_t *self);
 
-static fiber_t *scheduler_steal_once(scheduler_t *self);
+static void scheduler_notify(scheduler_t *self);
+static int scheduler_spent(scheduler_t *self);
+static int scheduler_run_once(scheduler_t *self, int budget, uint64_t deadline);
+static int scheduler_ready(scheduler_t *self);
+static int scheduler_event_fd(scheduler_t *self);
+
+static fiber_t *scheduler_steal_once(scheduler_t *self, int coupled);
 static fiber_t *scheduler_steal_loop(scheduler_t *self);
 static void *scheduler_start(void *data);
 
-static void scheduler_initialize(scheduler_t *self, int color) {
+static void scheduler_initialize(scheduler_t *self, co_runtime_t *runtime, int color) {
     self->color = color;
+    self->runtime = runtime;
     LOG("initialize", self, NULL);
 
     self->main = fiber_main();
     self->current = self->main;
+    atomic_init(&self->next, NULL);
+    atomic_init(&self->coupled, NULL);
+    atomic_init(&self->injected, NULL);
+    self->pinned_head = self->pinned_tail = NULL;
+    atomic_init(&self->parked, 0);
+    self->action = NULL;
+    self->action_data = NULL;
+    self->yielded = NULL;
+    self->budget = -1;
+    self->deadline = 0;
+    self->eventfd = -1;
+    atomic_init(&self->notified, 0);
+    arena_cache_initialize(&self->arena);
     //LOG("spawn_main", self, self->main);
 
-    queue_initialize(&self->runnables);
+    for (int level = 0; level < FIBER_PRIORITY_LEVELS; level++) {
+        queue_initialize(&self->runnables[level]);
+        self->skipped[level] = 0;
+    }
     queue_initialize(&self->pending);
     self->rng = (pcg32_random_t)PCG32_INITIALIZER;
     pcg32_srandom_r(&self->rng, rand(), 0);
@@ -72,12 +233,16 @@ static void scheduler_initialize(scheduler_t *self, int color) {
 static void scheduler_finalize(scheduler_t *self) {
     //LOG("finalize", self, NULL);
     scheduler_free_pending(self, -1);
-    queue_finalize(&self->runnables);
+    for (int level = 0; level < FIBER_PRIORITY_LEVELS; level++) {
+        queue_finalize(&self->runnables[level]);
+    }
     queue_finalize(&self->pending);
+    if (self->eventfd >= 0) close(self->eventfd);
     fiber_free(self->main);
+    arena_cache_finalize(&self->arena);
 }
 
-static fiber_t *scheduler_spawn(scheduler_t *self, fiber_main_t proc, char *name) {
+static fiber_t *scheduler_new_fiber(scheduler_t *self, fiber_main_t proc, char *name, int priority) {
     fiber_t *fiber;
 
     // try to recycle fiber + stack:
@@ -88,32 +253,106 @@ static fiber_t *scheduler_spawn(scheduler_t *self, fiber_main_t proc, char *name
         // allocate new fiber + stack:
         fiber = fiber_new(proc, on_fiber_exit, name);
     }
+    fiber->priority = priority;
+    fiber->home = self;
+
+    // inherit the cancellation token of the spawning fiber:
+    fiber->cancel = self->current ? self->current->cancel : NULL;
+    return fiber;
+}
+
+// Help-first: the child is enqueued and the parent continues.
+static fiber_t *scheduler_spawn(scheduler_t *self, fiber_main_t proc, char *name, int priority) {
+    fiber_t *fiber = scheduler_new_fiber(self, proc, name, priority);
 
     LOG("spawn", self, fiber);
     scheduler_enqueue(self, fiber);
     return fiber;
 }
 
+// Work-first: the child is resumed immediately and the parent's continuation
+// is enqueued once switched out, so it's resumed as soon as the child
+// suspends or exits, unless a thief stole it in the meantime. Thieves steal
+// from the top of the deque, that is the oldest (shallowest) continuations,
+// so a recursive computation only keeps about P x depth fibers alive instead
+// of pushing every child upfront.
+static void scheduler_spawn_now(scheduler_t *self, fiber_main_t proc, char *name) {
+    fiber_t *current = self->current;
+    fiber_t *fiber = scheduler_new_fiber(self, proc, name, current->priority);
+
+    // the main fiber is never enqueued:
+    if (current == self->main) {
+        LOG("spawn", self, fiber);
+        scheduler_enqueue(self, fiber);
+        return;
+    }
+
+    LOG("spawn_now", self, fiber);
+    self->yielded = current;
+    scheduler_switch(self, fiber, NULL, NULL);
+}
+
+static void on_fiber_start() {
+    // a new fiber didn't return from a context switch: run the action of the
+    // fiber that switched to it (if any):
+    scheduler_after_switch(co_tl_scheduler);
+}
+
+static void scheduler_push_pending(void *data) {
+    scheduler_t *scheduler = co_tl_scheduler;
+    queue_push_bottom(&scheduler->pending, (fiber_t *)data);
+}
+
+// Wakes up the fibers that join the exited fiber (see co_join), that may be
+// recycled as soon as its generation changed, and notifies its nursery.
+static void scheduler_exited(fiber_t *fiber) {
+    co_nursery_t *nursery = fiber->nursery;
+
+    atomic_fetch_add(&fiber->generation, 1);
+    if (atomic_load(&fiber->joiners)) {
+        atomic_store(&fiber->joiners, 0);
+        parking_lot_unpark_all(fiber, 0);
+    }
+
+    if (nursery) {
+        co_waitgroup_done(&nursery->group);
+    }
+}
+
 static void on_fiber_exit() {
     // We can't munmap the stack of the current fiber, otherwise current stack
     // frames would become inaccessible, resulting in an immediate segfault. We
     // thus delay the call to `fiber_free` to later on. This also makes it
     // possible to recycle a fiber + stack.
+    //
+    // The fiber is only pushed to pending once we switched away from its
+    // stack, so it can't be recycled (or freed) while still in use.
 
-    scheduler_t *scheduler = pthread_getspecific(tl_scheduler);
+    // destructors run on the fiber, that may still suspend (and migrate):
+    fiber_fls_release(co_tl_current);
+
+    scheduler_t *scheduler = co_tl_scheduler;
     fiber_t *fiber = scheduler->current;
+    if (fiber->arena) arena_release(&fiber->arena, &scheduler->arena);
+    scheduler_exited(fiber);
     scheduler->current = NULL;
 
     LOG("done", scheduler, fiber);
-    queue_push_bottom(&scheduler->pending, fiber);
-
-    scheduler_resume(scheduler, scheduler->main);
+    fiber_t *next = scheduler_pick(scheduler);
+    scheduler_switch(scheduler, next ? next : scheduler->main, scheduler_push_pending, fiber);
 }
 
 static void scheduler_free_pending(scheduler_t *self, int count) {
     for (int i = 0; count < 0 || i < count; i++) {
         fiber_t *fiber = queue_pop_top(&self->pending);
         if (!fiber) break;
+
+        // join handles still refer to the fiber (the runtime is only
+        // finalized once all fibers are done):
+        if (count >= 0 && atomic_load(&fiber->handles)) {
+            queue_push_bottom(&self->pending, fiber);
+            continue;
+        }
         //if (fiber != self->main) {
             LOG("free", self, fiber);
             fiber_free(fiber);
@@ -121,52 +360,359 @@ static void scheduler_free_pending(scheduler_t *self, int count) {
     }
 }
 
+// Pushes a fiber to a local queue (the current thread must own the scheduler).
+static void scheduler_push(scheduler_t *self, fiber_t *fiber) {
+    if (fiber->pinned) {
+        fiber->m_next = NULL;
+        if (self->pinned_head) {
+            self->pinned_tail = self->pinned_tail->m_next = fiber;
+        } else {
+            self->pinned_tail = self->pinned_head = fiber;
+        }
+    } else {
+        queue_push_bottom(&self->runnables[fiber->priority], (void *)fiber);
+    }
+}
+
+// Enqueues the fiber on its home scheduler instead of the current one, as
+// decided by the wake policy. Returns 0 if the fiber must be enqueued locally.
+static int scheduler_inject(scheduler_t *self, fiber_t *fiber) {
+    scheduler_t *home = fiber->home;
+
+    if (!home || home == self) return 0;
+
+    // fibers never leave their runtime (the first scheduler is always
+    // active):
+    if (home->runtime != self->runtime) {
+        if (scheduler_surplus(home)) home = home->runtime->schedulers;
+        scheduler_push_remote(home, fiber);
+        return 1;
+    }
+
+    if (!fiber->pinned && self->runtime->wake_policy != SCHEDULER_WAKE_HOME) return 0;
+
+    // a surplus scheduler would merely forward the fiber (unpinned):
+    if (scheduler_surplus(home)) {
+        fiber->pinned = 0;
+        return 0;
+    }
+
+    scheduler_push_remote(home, fiber);
+    return 1;
+}
+
+// Pushes a fiber to the injected list of another scheduler.
+static void scheduler_push_remote(scheduler_t *target, fiber_t *fiber) {
+    LOG("inject", target, fiber);
+    fiber_t *head = atomic_load_explicit(&target->injected, memory_order_relaxed);
+    do {
+        fiber->m_next = head;
+    } while (!atomic_compare_exchange_weak(&target->injected, &head, fiber));
+
+    // the target thread must resume the fiber (it may be parked, or embedded
+    // in an event loop):
+    scheduler_notify(target);
+    scheduler_unpark_one(target);
+}
+
+// Enqueues a fiber from a thread that runs no scheduler (e.g. a callback
+// thread of a library): the fiber is injected into its home scheduler, whose
+// thread is unparked (if needed).
+static void scheduler_enqueue_foreign(fiber_t *fiber) {
+    scheduler_t *home = fiber->home;
+
+    if (scheduler_surplus(home)) {
+        fiber->pinned = 0;
+        home = home->runtime->schedulers;
+    }
+    scheduler_push_remote(home, fiber);
+}
+
+// Moves injected fibers to local queues.
+static void scheduler_drain(scheduler_t *self) {
+    fiber_t *fiber = atomic_exchange(&self->injected, NULL);
+
+    // fibers have been pushed in reverse order:
+    fiber_t *list = NULL;
+    while (fiber) {
+        fiber_t *next = fiber->m_next;
+        fiber->m_next = list;
+        list = fiber;
+        fiber = next;
+    }
+
+    while (list) {
+        fiber_t *next = list->m_next;
+        scheduler_push(self, list);
+        list = next;
+    }
+}
+
 static void scheduler_enqueue(scheduler_t *self, fiber_t *fiber) {
     LOG("enqueue", self, fiber);
-    queue_push_bottom(&self->runnables, (void *)fiber);
+    if (scheduler_inject(self, fiber)) return;
+
+    scheduler_push(self, fiber);
+    scheduler_notify(self);
 
     // resume a parked thread (if any):
-    scheduler_unpark();
+    if (!fiber->pinned) scheduler_unpark(self->runtime, 1);
 }
 
-static void scheduler_resume(scheduler_t *self, fiber_t *fiber) {
+// Tracks which fiber wakes `fiber` up. Returns true once the current fiber
+// woke it up CO_COUPLING_THRESHOLD times in a row. The woken fiber is
+// suspended and owned by the waker, so nothing else accesses these fields.
+static int scheduler_couple(scheduler_t *self, fiber_t *fiber) {
+#if CO_COUPLING_THRESHOLD
+    fiber_t *waker = self->current;
+    if (!waker || waker == self->main || fiber->pinned || scheduler_foreign(self, fiber)) return 0;
+
+    if (fiber->peer == waker) {
+        if (fiber->coupling < CO_COUPLING_THRESHOLD) fiber->coupling++;
+    } else {
+        fiber->peer = waker;
+        fiber->coupling = 1;
+    }
+    return fiber->coupling >= CO_COUPLING_THRESHOLD;
+#else
+    return 0;
+#endif
+}
+
+// Enqueues a fiber woken up by the current fiber (e.g. channel, mutex).
+// Strongly coupled fibers gradually gather on the same scheduler: a coupled
+// fiber takes the coupled slot (if free) where thieves leave it alone for a
+// while, so it's most likely resumed by the waker's thread, and adopts the
+// scheduler as its new home (wake home policy).
+static void scheduler_wake(scheduler_t *self, fiber_t *fiber) {
+    if (scheduler_couple(self, fiber)) {
+        fiber_t *expected = NULL;
+
+        if (!atomic_load_explicit(&self->coupled, memory_order_relaxed) &&
+                atomic_compare_exchange_strong(&self->coupled, &expected, fiber)) {
+            LOG("wake_coupled", self, fiber);
+            fiber->home = self;
+            scheduler_notify(self);
+            return;
+        }
+    }
+    scheduler_enqueue(self, fiber);
+}
+
+static void scheduler_enqueue_list(scheduler_t *self, fiber_t *fiber) {
+    int count = 0;
+
+    while (fiber) {
+        // an enqueued fiber may be stolen and resumed right away, so we must
+        // read the next fiber first:
+        fiber_t *next = fiber->m_next;
+        LOG("enqueue", self, fiber);
+        if (!scheduler_inject(self, fiber)) {
+            scheduler_push(self, fiber);
+            count += !fiber->pinned;
+        }
+        fiber = next;
+    }
+
+    // resume parked threads (if any):
+    scheduler_notify(self);
+    scheduler_unpark(self->runtime, count);
+}
+
+static void scheduler_enqueue_next(scheduler_t *self, fiber_t *fiber) {
+    LOG("enqueue_next", self, fiber);
+
+    // the next-run position may be stolen:
+    if (fiber->pinned || scheduler_foreign(self, fiber) ||
+            (fiber->home != self && self->runtime->wake_policy == SCHEDULER_WAKE_HOME)) {
+        scheduler_enqueue(self, fiber);
+        return;
+    }
+
+    // takes the next-run position, and kicks the previous fiber (if any) into
+    // the queue:
+    fiber_t *previous = atomic_exchange(&self->next, fiber);
+    scheduler_notify(self);
+    if (previous) {
+        scheduler_enqueue(self, previous);
+    } else {
+        scheduler_unpark(self->runtime, 1);
+    }
+}
+
+static fiber_t *scheduler_next(scheduler_t *self) {
+    // next-run position first (may be stolen, hence the exchange):
+    if (atomic_load_explicit(&self->next, memory_order_relaxed)) {
+        fiber_t *fiber = atomic_exchange(&self->next, NULL);
+        if (fiber) return fiber;
+    }
+
+    // then the coupled fiber (may be stolen too), unless it would bypass
+    // priorities, in which case it's put back (only the owner fills the slot):
+    fiber_t *coupled = NULL;
+    if (atomic_load_explicit(&self->coupled, memory_order_relaxed)) {
+        coupled = atomic_exchange(&self->coupled, NULL);
+        if (coupled) {
+            if (scheduler_admit(self, coupled->priority)) return coupled;
+            atomic_store(&self->coupled, coupled);
+        }
+    }
+
+    if (atomic_load_explicit(&self->injected, memory_order_relaxed)) {
+        scheduler_drain(self);
+    }
+
+    // pinned fibers (only this scheduler may resume them):
+    if (self->pinned_head) {
+        fiber_t *fiber = self->pinned_head;
+        self->pinned_head = fiber->m_next;
+        return fiber;
+    }
+
+    fiber_t *fiber = scheduler_pop(self);
+    if (!fiber && coupled) {
+        fiber = atomic_exchange(&self->coupled, NULL);
+    }
+    return fiber;
+}
+
+// Levels from `level` with runnable fibers have been skipped.
+static void scheduler_skip(scheduler_t *self, int level) {
+    for (int l = level; l < FIBER_PRIORITY_LEVELS; l++) {
+        if (queue_lazy_size(&self->runnables[l]) > 0) {
+            self->skipped[l]++;
+        }
+    }
+}
+
+// Whether a fiber at `level` may run before the queued fibers: no higher level
+// has runnable fibers, and no level (including its own: the fiber jumps the
+// queue) has been skipped for too long.
+static int scheduler_admit(scheduler_t *self, int level) {
+    for (int l = 0; l < FIBER_PRIORITY_LEVELS; l++) {
+        if (l < level && queue_lazy_size(&self->runnables[l]) > 0) return 0;
+        if (l >= level && self->skipped[l] >= CO_PRIORITY_AGING) return 0;
+    }
+    scheduler_skip(self, level);
+    return 1;
+}
+
+static fiber_t *scheduler_pop(scheduler_t *self) {
+    fiber_t *fiber;
+
+    // aging: serve a level that has been skipped for too long:
+    for (int level = FIBER_PRIORITY_LEVELS - 1; level >= 0; level--) {
+        if (self->skipped[level] >= CO_PRIORITY_AGING) {
+            self->skipped[level] = 0;
+            fiber = queue_pop_bottom(&self->runnables[level]);
+            if (fiber) return fiber;
+        }
+    }
+
+    // highest level first:
+    for (int level = 0; level < FIBER_PRIORITY_LEVELS; level++) {
+        fiber = queue_pop_bottom(&self->runnables[level]);
+
+        if (fiber) {
+            scheduler_skip(self, level + 1);
+            return fiber;
+        }
+    }
+    return NULL;
+}
+
+static void scheduler_switch(scheduler_t *self, fiber_t *fiber, scheduler_action_t action, void *data) {
     fiber_t *current = self->current;
     self->current = fiber;
+    co_tl_current = fiber;
+
+    // a fiber must never be published (enqueued, added to a wait list, ...)
+    // before its context has been saved, otherwise another thread could steal
+    // and resume it too early. Suspending fibers thus publish themselves
+    // through an action that runs after the context switch:
+    self->action = action;
+    self->action_data = data;
 
-    // avoid a race condition when a thread may stole a just enqueued fiber
-    // whose context hasn't be saved yet, which can happen when a thread
-    // enqueues then suspends a Fiber. swapcontext is thus responsible for
-    // (un)setting fiber->resumeable when appropriate.
-    spin_lock_long(&fiber->resumeable);
     LOG("resume", self, fiber);
+    self->switches++;
+
+    if (fiber->home != self && !fiber->pinned) {
+        if (fiber->home) self->migrations++;
+        fiber->home = self;
+    }
 
     if (current) {
         //LOG("swapcontext", self, fiber);
-        co_swapcontext(current, fiber);
+        // the current fiber may be resumed by another thread, that passes
+        // its own scheduler:
+        self = co_swapcontext(current, fiber, self);
     } else {
         //LOG("setcontext", self, fiber);
-        co_setcontext(fiber);
+        co_setcontext(fiber, self);
     }
+
+    scheduler_after_switch(self);
 }
 
-static void scheduler_reschedule(scheduler_t *self) {
-    LOG("suspend", self, self->current);
+static void scheduler_after_switch(scheduler_t *self) {
+    scheduler_action_t action = self->action;
 
-    // if any fiber is in queue, resume it:
-    fiber_t *fiber = queue_pop_bottom(&self->runnables);
+    if (action) {
+        self->action = NULL;
+        action(self->action_data);
+    }
 
-    //if (!fiber) {
-    //    // try to steal a fiber (avoid a context switch to main):
-    //    fiber = scheduler_steal_once(self);
-    //
-        // fallback to resume main fiber, allowing to save the current fiber
-        // context (making it resumeable):
-        if (!fiber) {
-            fiber = self->main;
-        }
-    //}
+    // the fiber that yielded (if any):
+    fiber_t *yielded = self->yielded;
+    if (yielded) {
+        self->yielded = NULL;
+        scheduler_enqueue(self, yielded);
+    }
+}
 
-    scheduler_resume(self, fiber);
+static void scheduler_resume(scheduler_t *self, fiber_t *fiber) {
+    scheduler_switch(self, fiber, NULL, NULL);
+}
+
+static fiber_t *scheduler_pick(scheduler_t *self) {
+#if CO_DIRECT_SWITCH
+    // the main fiber must stop (or retire) the scheduler thread:
+    co_runtime_t *runtime = self->runtime;
+    if (runtime->maxprocs && (!runtime->running || scheduler_surplus(self))) {
+        return NULL;
+    }
+
+    // embedded: return to the host loop once the budget is spent:
+    if (self->budget >= 0 && scheduler_spent(self)) {
+        return NULL;
+    }
+
+    fiber_t *fiber = scheduler_next(self);
+
+    // try to steal a fiber (avoids a context switch to main):
+    if (!fiber && atomic_load_explicit(&runtime->nprocs, memory_order_relaxed) > 1) {
+        fiber = scheduler_steal_once(self, 0);
+    }
+
+    if (fiber && self->budget > 0) {
+        self->budget--;
+    }
+    return fiber;
+#else
+    return scheduler_next(self);
+#endif
+}
+
+static void scheduler_reschedule(scheduler_t *self, scheduler_action_t action, void *data) {
+    LOG("suspend", self, self->current);
+
+    // resume the next runnable fiber, or fallback to the main fiber:
+    fiber_t *fiber = scheduler_pick(self);
+    if (!fiber) {
+        fiber = self->main;
+    }
+
+    scheduler_switch(self, fiber, action, data);
 }
 
 static void scheduler_yield(scheduler_t *self) {
@@ -174,31 +720,148 @@ static void scheduler_yield(scheduler_t *self) {
     // *before* enqueuing the current fiber, which would otherwise be the one
     // to be picked up, which is pointless.
 
-    // if any fiber is in queue, resume it:
-    fiber_t *fiber = queue_pop_bottom(&self->runnables);
+    // if any fiber is runnable, resume it:
+    fiber_t *fiber = scheduler_pick(self);
 
-    //if (!fiber) {
-    //    // try to steal a fiber (avoid a context switch to main):
-    //    fiber = scheduler_steal_once(self);
+    if (!fiber) {
+#if CO_DIRECT_SWITCH
+        // nothing else to run: continue the current fiber:
+        if ((self->runtime->running && !scheduler_surplus(self)) || self->current == self->main) return;
+#endif
+        // fallback to resume main fiber:
+        fiber = self->main;
+    }
 
-        // fallback to resume main fiber, allowing to save the current fiber
-        // context (making it resumeable):
-        if (!fiber) {
-            fiber = self->main;
+    // actual yield (the current fiber is enqueued once switched out):
+    self->yielded = self->current;
+    scheduler_switch(self, fiber, NULL, NULL);
+}
+
+// Signals the eventfd of the scheduler (if any) once until the next run.
+static void scheduler_notify(scheduler_t *self) {
+    if (self->eventfd < 0) return;
+
+    if (!atomic_load_explicit(&self->notified, memory_order_relaxed) &&
+            !atomic_exchange(&self->notified, 1)) {
+        uint64_t one = 1;
+        if (write(self->eventfd, &one, sizeof(one)) != sizeof(one)) {
+            error(0, errno, "write(eventfd)");
         }
-    //}
+    }
+}
+
+static inline uint64_t scheduler_clock() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
 
-    // actual yield:
-    scheduler_enqueue(self, self->current);
-    scheduler_resume(self, fiber);
+// Whether the embedded run must return to the host loop.
+static int scheduler_spent(scheduler_t *self) {
+    return self->budget == 0 || (self->deadline && scheduler_clock() >= self->deadline);
 }
 
-static fiber_t *scheduler_steal_once(scheduler_t *self) {
-    int j = pcg32_boundedrand_r(&self->rng, co_nprocs);
-    scheduler_t *victim = (scheduler_t *)co_schedulers + j;
+// Resumes ready fibers on the calling thread, from its main fiber (e.g. the
+// event loop of a host application), until `budget` fibers have been resumed
+// (0: no limit), the deadline is reached (0: none) or no fiber is ready.
+// Fibers switch directly to each other, and only switch back to the main
+// fiber once the budget is spent. Returns the number of resumed fibers.
+static int scheduler_run_once(scheduler_t *self, int budget, uint64_t deadline) {
+    if (self->current != self->main) return 0;
+
+    // fibers enqueued from now on signal the eventfd again:
+    if (self->eventfd >= 0 && atomic_exchange(&self->notified, 0)) {
+        uint64_t count;
+        if (read(self->eventfd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+            error(0, errno, "read(eventfd)");
+        }
+    }
+
+    int initial = budget > 0 ? budget : INT_MAX;
+    self->budget = initial;
+    self->deadline = deadline;
+
+    while (!scheduler_spent(self)) {
+        fiber_t *fiber = scheduler_next(self);
+        if (!fiber) break;
+
+        self->budget--;
+        scheduler_resume(self, fiber);
+    }
+
+    int count = initial - self->budget;
+    self->budget = -1;
+    self->deadline = 0;
+
+    // stopped on budget or deadline: fibers are still ready, so the host loop
+    // must come back (the eventfd was reset on entry):
+    if (self->eventfd >= 0 && scheduler_ready(self) > 0) {
+        scheduler_notify(self);
+    }
+    return count;
+}
+
+// Number of fibers ready to run on the scheduler (approximate).
+static int scheduler_ready(scheduler_t *self) {
+    if (atomic_load_explicit(&self->injected, memory_order_relaxed)) {
+        scheduler_drain(self);
+    }
+
+    int count = (atomic_load_explicit(&self->next, memory_order_relaxed) != NULL) +
+        (atomic_load_explicit(&self->coupled, memory_order_relaxed) != NULL);
+
+    for (fiber_t *fiber = self->pinned_head; fiber; fiber = fiber->m_next) {
+        count++;
+    }
+    for (int level = 0; level < FIBER_PRIORITY_LEVELS; level++) {
+        count += queue_lazy_size(&self->runnables[level]);
+    }
+    return count;
+}
+
+// Returns an eventfd that becomes readable whenever a fiber is enqueued on
+// the scheduler (from any thread), so a host event loop can wait for it along
+// with its own file descriptors, then call co_run_once.
+static int scheduler_event_fd(scheduler_t *self) {
+    if (self->eventfd < 0) {
+        self->eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (self->eventfd < 0) {
+            error(0, errno, "eventfd");
+            return -1;
+        }
+
+        // fibers may already be waiting:
+        if (scheduler_ready(self)) scheduler_notify(self);
+    }
+    return self->eventfd;
+}
+
+static fiber_t *scheduler_steal_once(scheduler_t *self, int coupled) {
+    // only active schedulers (surplus ones are drained by their thread):
+    co_runtime_t *runtime = self->runtime;
+    int j = pcg32_boundedrand_r(&self->rng, atomic_load_explicit(&runtime->nprocs, memory_order_acquire));
+    scheduler_t *victim = runtime->schedulers + j;
 
     if (victim != self) {
-        return queue_pop_top(&victim->runnables);
+        fiber_t *fiber = NULL;
+
+        // steal from the highest level first:
+        for (int level = 0; !fiber && level < FIBER_PRIORITY_LEVELS; level++) {
+            fiber = queue_pop_top(&victim->runnables[level]);
+        }
+
+        // the victim's next-run fiber waits for the victim to suspend or
+        // yield its current fiber, which may take a while:
+        if (!fiber && atomic_load_explicit(&victim->next, memory_order_relaxed)) {
+            fiber = atomic_exchange(&victim->next, NULL);
+        }
+
+        // the coupled fiber should be resumed by the victim's thread soon,
+        // unless its current fiber keeps running:
+        if (!fiber && coupled && atomic_load_explicit(&victim->coupled, memory_order_relaxed)) {
+            fiber = atomic_exchange(&victim->coupled, NULL);
+        }
+        return fiber;
     }
     return NULL;
 }
@@ -211,11 +874,17 @@ static fiber_t *scheduler_steal_loop(scheduler_t *self) {
     while (iterations--) {
         sched_yield();
 
-        if (!co_running) {
+        if (!self->runtime->running) {
             return NULL;
         }
 
-        fiber = scheduler_steal_once(self);
+        // a fiber may have been injected in the meantime:
+        if (atomic_load_explicit(&self->injected, memory_order_relaxed)) {
+            fiber = scheduler_next(self);
+            if (fiber) return fiber;
+        }
+
+        fiber = scheduler_steal_once(self, iterations < CO_COUPLING_PATIENCE);
         if (fiber) {
             //LOG("stole", self, fiber);
             return fiber;
@@ -226,28 +895,145 @@ static fiber_t *scheduler_steal_loop(scheduler_t *self) {
     return NULL;
 }
 
-static void scheduler_park() {
-    pthread_mutex_lock(&co_park_mtx);
-    co_park_count++;
-    pthread_cond_wait(&co_park_cond, &co_park_mtx);
-    co_park_count--;
-    pthread_mutex_unlock(&co_park_mtx);
+// Parks the scheduler thread. Surplus schedulers aren't counted as parked,
+// since scheduler_unpark only resumes active ones.
+//
+// The thread sleeps on its `parked` word (futex), so resuming it is a single
+// atomic transition (see scheduler_unpark_one), that any thread can do without
+// taking a lock, including threads that run no scheduler.
+static void scheduler_park(scheduler_t *self, int surplus) {
+    co_runtime_t *runtime = self->runtime;
+    if (!surplus) atomic_fetch_add(&runtime->park_count, 1);
+
+    // publish the parked state, then re-check whether the runtime is stopping
+    // (co_runtime_wait stops it then unparks all threads), for injected fibers
+    // (scheduler_inject pushes then checks the parked state) and whether the
+    // scheduler is still surplus (scheduler_resize updates the count then
+    // checks the parked state):
+    atomic_store(&self->parked, 1);
+
+    if (runtime->running && !atomic_load(&self->injected) && (!surplus || scheduler_surplus(self))) {
+        // unparking clears the word before it wakes the thread up:
+        while (atomic_load(&self->parked)) {
+            syscall(SYS_futex, &self->parked, FUTEX_WAIT_PRIVATE, 1, NULL, NULL, 0);
+        }
+    }
+    atomic_store(&self->parked, 0);
+
+    if (!surplus) atomic_fetch_sub(&runtime->park_count, 1);
+}
+
+// Resumes the thread of a specific scheduler, if parked. Returns true if the
+// thread was parked.
+static int scheduler_unpark_one(scheduler_t *self) {
+    if (!atomic_load(&self->parked) || !atomic_exchange(&self->parked, 0)) return 0;
+    syscall(SYS_futex, &self->parked, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+    return 1;
+}
+
+// Resumes up to `count` parked threads (if any).
+static void scheduler_unpark(co_runtime_t *runtime, int count) {
+    if (!atomic_load_explicit(&runtime->park_count, memory_order_relaxed) || !count) return;
+
+    int nprocs = atomic_load_explicit(&runtime->nprocs, memory_order_relaxed);
+    for (int i = 0; count && i < nprocs; i++) {
+        if (scheduler_unpark_one(runtime->schedulers + i)) count--;
+    }
+}
+
+static void scheduler_unpark_all(co_runtime_t *runtime) {
+    int started = atomic_load(&runtime->started);
+    for (int i = 0; i < started; i++) {
+        scheduler_unpark_one(runtime->schedulers + i);
+    }
+}
+
+// Whether the scheduler is beyond the number of active schedulers.
+static int scheduler_surplus(scheduler_t *self) {
+    co_runtime_t *runtime = self->runtime;
+    return runtime->maxprocs &&
+        self - runtime->schedulers >= atomic_load_explicit(&runtime->nprocs, memory_order_relaxed);
 }
 
-static void scheduler_unpark() {
-    if (!co_park_count) return;
-    pthread_mutex_lock(&co_park_mtx);
-    pthread_cond_signal(&co_park_cond);
-    pthread_mutex_unlock(&co_park_mtx);
+// Whether the fiber belongs to another runtime.
+static int scheduler_foreign(scheduler_t *self, fiber_t *fiber) {
+    return fiber->home && fiber->home->runtime != self->runtime;
+}
+
+// Initializes the schedulers up to `count`, starting their thread if the
+// runtime is running (otherwise co_runtime_start does). Schedulers are only
+// created once the runtime grows, since each one reserves its queues and a
+// thread. Must be called with the monitor lock of the runtime held.
+static void scheduler_grow(co_runtime_t *runtime, int count) {
+    int started = atomic_load_explicit(&runtime->started, memory_order_relaxed);
+
+    for (int i = started; i < count; i++) {
+        scheduler_initialize(runtime->schedulers + i, runtime, 32 + i);
+    }
+    if (count <= started) return;
+    atomic_store_explicit(&runtime->started, count, memory_order_release);
+
+    if (runtime->running) {
+        for (int i = runtime->nthreads; i < count; i++) {
+            if (pthread_create(&runtime->threads[i], NULL, scheduler_start, runtime->schedulers + i)) {
+                error(1, 0, "pthread_create failed");
+            }
+        }
+        runtime->nthreads = count;
+    }
+}
+
+// Changes the number of active schedulers. Surplus schedulers retire once
+// their current fiber is suspended; schedulers that become active again are
+// resumed. Must be called with the monitor lock of the runtime held.
+static void scheduler_resize(co_runtime_t *runtime, int count) {
+    if (count < 1) count = 1;
+    if (count > runtime->maxprocs) count = runtime->maxprocs;
+    scheduler_grow(runtime, count);
+
+    int previous = atomic_exchange(&runtime->nprocs, count);
+    int from = previous < count ? previous : count;
+    int to = previous < count ? count : previous;
+
+    // resume parked schedulers that changed state: growing ones must run,
+    // shrinking ones must park again as surplus:
+    for (int i = from; i < to; i++) {
+        scheduler_unpark_one(runtime->schedulers + i);
+    }
+}
+
+// Moves all the fibers of a surplus scheduler to the active schedulers.
+// Pinned fibers are unpinned, since their thread is about to park.
+static void scheduler_retire(scheduler_t *self) {
+    fiber_t *fiber;
+    int i = 0;
+
+    // the scheduler may become active again in the meantime:
+    while (scheduler_surplus(self) && (fiber = scheduler_next(self))) {
+        int nprocs = atomic_load_explicit(&self->runtime->nprocs, memory_order_relaxed);
+        scheduler_t *target = self->runtime->schedulers + (i++ % nprocs);
+
+        fiber->pinned = 0;
+        fiber->home = target;
+        scheduler_push_remote(target, fiber);
+    }
 }
 
 static void *scheduler_start(void *data) {
     scheduler_t *scheduler = (scheduler_t *)data;
-    pthread_setspecific(tl_scheduler, scheduler);
+    co_tl_scheduler = scheduler;
+    co_tl_current = scheduler->current;
+
+    while (scheduler->runtime->running) {
+        if (scheduler_surplus(scheduler)) {
+            LOG("retire", scheduler, NULL);
+            scheduler_retire(scheduler);
+            scheduler_park(scheduler, 1);
+            continue;
+        }
 
-    while (co_running) {
         // consume from internal queue:
-        fiber_t *fiber = queue_pop_bottom(&scheduler->runnables);
+        fiber_t *fiber = scheduler_next(scheduler);
 
         if (!fiber) {
             // empty queue: become thief:
@@ -257,9 +1043,9 @@ static void *scheduler_start(void *data) {
 
         if (fiber) {
             scheduler_resume(scheduler, fiber);
-        } else if (co_running) {
+        } else if (scheduler->runtime->running) {
             // nothing to steal: pause thread
-            scheduler_park();
+            scheduler_park(scheduler, 0);
         }
     }
 
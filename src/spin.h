@@ -21,32 +21,40 @@
 // 3. test the value then block loop;
 //    eventually delegates to the kernel to block and resume the thread.
 //
+// Two lock variants are available:
+//
+// - spin_lock_flag: test-and-set loop; every waiting thread writes the same
+//   cache line.
+//
+// - spin_lock: test-and-test-and-set loop with a pause instruction; waiting
+//   threads only read the cache line until it's released. The busy loop
+//   adapts to the observed waiting time: acquiring the lock after N
+//   iterations moves the estimate toward N, while exhausting the budget
+//   (long hold times) makes it shrink, so threads yield sooner.
+//
+// An MCS queue lock is compared against them in benchmarks/spin.c, but isn't
+// used: it hands the lock over to the next waiter even if its thread was
+// preempted, which stalls all the following waiters when there are more
+// threads than CPUs.
+//
 // References:
 // - "Empirical Studies of Competitive Spinning for a Shared-Memory Multiprocessor" (1991).
 
 #include <sched.h>
+#include <stdatomic.h>
 
 // Threshold is arbitrarily chosen. Using a computed value for an
 // x86_64-linux-gnu target actually led to worse performance.
 #define SPIN_LOCK_THRESHOLD (100)
 
-static inline void spin_lock_long(long *x) {
-    // fast path (always succeeds with a single threaded):
-    if (*x) return;
-
-    // fixed busy loop (avoids a thread context switch, which improves
-    // performance with many threads). we cut the threshold in half
-    int count = SPIN_LOCK_THRESHOLD;
-    while (count--) {
-        if (*x) return;
-    }
+// Bounds of the adaptive busy loop of spin_lock.
+#define SPIN_LOCK_MIN (10)
+#define SPIN_LOCK_MAX (1000)
 
-    // blocking loop (let the kernel resume another thread):
-    while (!(*x)) sched_yield();
-}
-
-static inline void spin_unlock_long(long *x) {
-    *x = 0;
+static inline void spin_pause() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
 }
 
 static inline void spin_lock_flag(atomic_flag *x) {
@@ -64,10 +72,6 @@ static inline void spin_lock_flag(atomic_flag *x) {
         }
     }
 
-    // TODO: consider an adaptive spinning strategy, for example random walk
-    // from "Empirical Studies of Competitive Spinning for a Shared-Memory
-    // Multiprocessor" (1991) page 5.
-
     // blocking loop (let the kernel resume another thread):
     while (atomic_flag_test_and_set_explicit(x, memory_order_acquire)) {
         sched_yield();
@@ -78,4 +82,58 @@ static inline void spin_unlock_flag(atomic_flag *x) {
     atomic_flag_clear_explicit(x, memory_order_release);
 }
 
+typedef struct {
+    atomic_int locked;
+    atomic_int spins; // estimate of busy loop iterations to acquire the lock
+} spin_t;
+
+#define SPIN_INITIALIZER { 0, SPIN_LOCK_MIN }
+
+static inline void spin_init(spin_t *x) {
+    atomic_init(&x->locked, 0);
+    atomic_init(&x->spins, SPIN_LOCK_MIN);
+}
+
+static inline int spin_trylock(spin_t *x) {
+    return !atomic_load_explicit(&x->locked, memory_order_relaxed) &&
+        !atomic_exchange_explicit(&x->locked, 1, memory_order_acquire);
+}
+
+static inline void spin_lock_slow(spin_t *x) {
+    int spins = atomic_load_explicit(&x->spins, memory_order_relaxed);
+    int budget = spins * 2;
+    if (budget < SPIN_LOCK_MIN) budget = SPIN_LOCK_MIN;
+    if (budget > SPIN_LOCK_MAX) budget = SPIN_LOCK_MAX;
+
+    // adaptive busy loop (only reads the lock until it looks released):
+    for (int i = 0; i < budget; i++) {
+        spin_pause();
+
+        if (spin_trylock(x)) {
+            atomic_store_explicit(&x->spins, spins + (i - spins) / 8, memory_order_relaxed);
+            return;
+        }
+    }
+
+    // the lock is held for long: spin less next time:
+    atomic_store_explicit(&x->spins, spins - spins / 8, memory_order_relaxed);
+
+    // blocking loop (let the kernel resume another thread):
+    while (!spin_trylock(x)) {
+        sched_yield();
+    }
+}
+
+static inline void spin_lock(spin_t *x) {
+    // fast path (always succeeds with a single threaded):
+    if (!atomic_exchange_explicit(&x->locked, 1, memory_order_acquire)) {
+        return;
+    }
+    spin_lock_slow(x);
+}
+
+static inline void spin_unlock(spin_t *x) {
+    atomic_store_explicit(&x->locked, 0, memory_order_release);
+}
+
 #endif
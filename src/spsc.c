@@ -0,0 +1,148 @@
+#include "muco.h"
+#include "muco/spsc.h"
+#include "parking_lot.h"
+
+#include <errno.h>
+#include <error.h>
+#include <stdlib.h>
+
+// Each side only ever writes its own index (head for the receiver, tail for
+// the sender) and keeps a cached copy of its peer's index, that is only
+// refreshed when the ring looks empty (or full). In the common case a send or
+// a receive thus does no read-modify-write: it's a release store of its index,
+// followed by a full memory barrier and a load of the peer's waiter slot (see
+// below).
+//
+// Fibers are only parked at the edges (empty or full ring), in the parking lot
+// (so they can be cancelled) on the address of their side's parked flag. The
+// parking fiber sets its flag then re-checks the peer's index, with the bucket
+// locked; the peer publishes its index then checks the flag, and unparks the
+// fiber if it's set. Both sides are separated by a full memory barrier, so at
+// least one of them sees the other. The barrier can't be left to the parking
+// side alone: the peer's store of its index could otherwise be delayed past
+// its load of the flag, and both would miss each other. Every send and
+// receive thus pays for one fence.
+
+void co_spsc_init(co_spsc_t *self, size_t capacity) {
+    size_t size = 1;
+    while (size < capacity) size <<= 1;
+
+    atomic_init(&self->head, 0);
+    self->tail_cache = 0;
+    atomic_init(&self->receiver, 0);
+
+    atomic_init(&self->tail, 0);
+    self->head_cache = 0;
+    atomic_init(&self->sender, 0);
+
+    self->capacity = size;
+    self->mask = size - 1;
+    atomic_init(&self->closed, 0);
+
+    self->buf = malloc(sizeof(void *) * size);
+    if (self->buf == NULL) {
+        error(1, errno, "malloc");
+    }
+}
+
+void co_spsc_destroy(co_spsc_t *self) {
+    free(self->buf);
+}
+
+struct spsc_park {
+    co_spsc_t *chan;
+    atomic_int *parked;
+    atomic_size_t *index;
+    size_t expected;
+};
+
+static int spsc_validate(void *data) {
+    struct spsc_park *p = data;
+    atomic_store(p->parked, 1);
+
+    // re-check after publishing (peer may have progressed in between):
+    if (atomic_load(p->index) == p->expected && !atomic_load(&p->chan->closed)) {
+        return 1;
+    }
+    atomic_store_explicit(p->parked, 0, memory_order_relaxed);
+    return 0;
+}
+
+// Returns ECANCELED if the current fiber has been cancelled, 0 otherwise (the
+// caller must re-check the peer's index).
+static int spsc_park(co_spsc_t *self, atomic_int *parked, atomic_size_t *index, size_t expected) {
+    struct spsc_park p = { self, parked, index, expected };
+    if (parking_lot_park(parked, spsc_validate, NULL, &p, 0, NULL) < 0) {
+        return ECANCELED;
+    }
+    return 0;
+}
+
+static inline void spsc_wakeup(atomic_int *parked) {
+    atomic_thread_fence(memory_order_seq_cst);
+
+    if (atomic_load_explicit(parked, memory_order_relaxed)) {
+        if (atomic_exchange(parked, 0)) parking_lot_unpark_one(parked, NULL, NULL);
+    }
+}
+
+int co_spsc_send(co_spsc_t *self, void *value) {
+    if (atomic_load_explicit(&self->closed, memory_order_relaxed)) return -1;
+
+    size_t tail = atomic_load_explicit(&self->tail, memory_order_relaxed);
+
+    // ring looks full: refresh the cached head, then wait for some room:
+    if (tail - self->head_cache == self->capacity) {
+        self->head_cache = atomic_load_explicit(&self->head, memory_order_acquire);
+
+        while (tail - self->head_cache == self->capacity) {
+            if (atomic_load(&self->closed)) return -1;
+            if (spsc_park(self, &self->sender, &self->head, self->head_cache)) return ECANCELED;
+            self->head_cache = atomic_load_explicit(&self->head, memory_order_acquire);
+        }
+    }
+
+    // publish value:
+    self->buf[tail & self->mask] = value;
+    atomic_store_explicit(&self->tail, tail + 1, memory_order_release);
+
+    // wakeup parked receiver (if any):
+    spsc_wakeup(&self->receiver);
+    return 0;
+}
+
+int co_spsc_receive(co_spsc_t *self, void **value) {
+    size_t head = atomic_load_explicit(&self->head, memory_order_relaxed);
+
+    // ring looks empty: refresh the cached tail, then wait for a value:
+    if (head == self->tail_cache) {
+        self->tail_cache = atomic_load_explicit(&self->tail, memory_order_acquire);
+
+        while (head == self->tail_cache) {
+            if (atomic_load(&self->closed)) {
+                // the sender may have published values right before closing:
+                self->tail_cache = atomic_load_explicit(&self->tail, memory_order_acquire);
+                if (head == self->tail_cache) return -1;
+                break;
+            }
+            if (spsc_park(self, &self->receiver, &self->tail, head)) return ECANCELED;
+            self->tail_cache = atomic_load_explicit(&self->tail, memory_order_acquire);
+        }
+    }
+
+    // consume value:
+    *value = self->buf[head & self->mask];
+    atomic_store_explicit(&self->head, head + 1, memory_order_release);
+
+    // wakeup parked sender (if any):
+    spsc_wakeup(&self->sender);
+    return 0;
+}
+
+void co_spsc_close(co_spsc_t *self) {
+    atomic_store(&self->closed, 1);
+
+    // wakeup parked fibers:
+    spsc_wakeup(&self->receiver);
+    spsc_wakeup(&self->sender);
+}
@@ -0,0 +1,171 @@
+#include "muco.h"
+#include "muco/sync.h"
+#include "parking_lot.h"
+
+#include <errno.h>
+#include <stddef.h>
+
+// All primitives follow the same protocol: a fiber that must block sets the
+// `waiters` flag (with the parking lot bucket locked) then re-checks the value
+// before parking, while a fiber that makes progress updates the value then
+// checks the flag, and only touches the parking lot when it's set.
+
+void co_sem_init(co_sem_t *sem, long value) {
+    atomic_init(&sem->value, value);
+    atomic_init(&sem->waiters, 0);
+}
+
+int co_sem_trywait(co_sem_t *sem) {
+    long value = atomic_load_explicit(&sem->value, memory_order_relaxed);
+
+    while (value > 0) {
+        if (atomic_compare_exchange_weak_explicit(&sem->value, &value, value - 1,
+                    memory_order_acquire, memory_order_relaxed)) {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static int sem_validate(void *data) {
+    co_sem_t *sem = data;
+    atomic_store(&sem->waiters, 1);
+    return atomic_load(&sem->value) <= 0;
+}
+
+int co_sem_wait(co_sem_t *sem) {
+    // fast path:
+    while (co_sem_trywait(sem)) {
+        // park until posted, then try again (another fiber may still take
+        // the value first):
+        if (parking_lot_park(sem, sem_validate, NULL, sem, 0, NULL) < 0) {
+            return ECANCELED;
+        }
+    }
+    return 0;
+}
+
+static uintptr_t sem_unpark(void *data, parking_waiter_t *waiter, int have_more) {
+    co_sem_t *sem = data;
+    (void)waiter;
+    atomic_store(&sem->waiters, have_more);
+    return 0;
+}
+
+void co_sem_post(co_sem_t *sem) {
+    atomic_fetch_add(&sem->value, 1);
+
+    if (atomic_load(&sem->waiters)) {
+        parking_lot_unpark_one(sem, sem_unpark, sem);
+    }
+}
+
+void co_latch_init(co_latch_t *latch, long count) {
+    atomic_init(&latch->count, count);
+    atomic_init(&latch->waiters, 0);
+}
+
+void co_latch_count_down(co_latch_t *latch, long n) {
+    long count = atomic_fetch_sub(&latch->count, n);
+
+    // last count down: release all waiting fibers at once:
+    if (count > 0 && count - n <= 0 && atomic_load(&latch->waiters)) {
+        atomic_store(&latch->waiters, 0);
+        parking_lot_unpark_all(latch, 0);
+    }
+}
+
+int co_latch_trywait(co_latch_t *latch) {
+    return atomic_load_explicit(&latch->count, memory_order_acquire) <= 0 ? 0 : -1;
+}
+
+static int latch_validate(void *data) {
+    co_latch_t *latch = data;
+    atomic_store(&latch->waiters, 1);
+    return atomic_load(&latch->count) > 0;
+}
+
+int co_latch_wait(co_latch_t *latch) {
+    while (co_latch_trywait(latch)) {
+        if (parking_lot_park(latch, latch_validate, NULL, latch, 0, NULL) < 0) {
+            return ECANCELED;
+        }
+    }
+    return 0;
+}
+
+#define BARRIER_GENERATION(state) ((state) >> 32)
+#define BARRIER_ARRIVALS(state) ((state) & 0xFFFFFFFFUL)
+
+void co_barrier_init(co_barrier_t *barrier, unsigned int count) {
+    barrier->count = count;
+    atomic_init(&barrier->state, 0);
+}
+
+struct barrier_wait {
+    co_barrier_t *barrier;
+    unsigned long generation;
+};
+
+static int barrier_validate(void *data) {
+    struct barrier_wait *w = data;
+    return BARRIER_GENERATION(atomic_load(&w->barrier->state)) == w->generation;
+}
+
+int co_barrier_wait(co_barrier_t *barrier) {
+    unsigned long state = atomic_fetch_add(&barrier->state, 1);
+    unsigned long generation = BARRIER_GENERATION(state);
+
+    if (BARRIER_ARRIVALS(state) + 1 == barrier->count) {
+        // last fiber to arrive: start next generation (no other fiber may
+        // arrive until released) then release all waiting fibers at once:
+        atomic_store(&barrier->state, (generation + 1) << 32);
+        parking_lot_unpark_all(barrier, 0);
+        return CO_BARRIER_SERIAL_FIBER;
+    }
+
+    // a cancelled fiber leaves, but still counts as arrived:
+    struct barrier_wait w = { barrier, generation };
+    while (barrier_validate(&w)) {
+        if (parking_lot_park(barrier, barrier_validate, NULL, &w, 0, NULL) < 0) {
+            return ECANCELED;
+        }
+    }
+    return 0;
+}
+
+#define WAITGROUP_WAITERS (1UL)
+#define WAITGROUP_COUNT(state) ((state) >> 1)
+
+void co_waitgroup_init(co_waitgroup_t *group) {
+    atomic_init(&group->state, 0);
+}
+
+void co_waitgroup_add(co_waitgroup_t *group, long n) {
+    atomic_fetch_add(&group->state, (unsigned long)n << 1);
+}
+
+void co_waitgroup_done(co_waitgroup_t *group) {
+    unsigned long state = atomic_fetch_sub(&group->state, 1UL << 1);
+
+    // last fiber done while fibers wait: the parking lot is only hashed by
+    // address, so the group may already be gone:
+    if (state == ((1UL << 1) | WAITGROUP_WAITERS)) {
+        parking_lot_unpark_all(group, 0);
+    }
+}
+
+static int waitgroup_validate(void *data) {
+    co_waitgroup_t *group = data;
+    unsigned long state = atomic_fetch_or(&group->state, WAITGROUP_WAITERS);
+    return WAITGROUP_COUNT(state) > 0;
+}
+
+int co_waitgroup_wait(co_waitgroup_t *group) {
+    while (WAITGROUP_COUNT(atomic_load(&group->state)) > 0) {
+        if (parking_lot_park(group, waitgroup_validate, NULL, group, 0, NULL) < 0) {
+            return ECANCELED;
+        }
+    }
+    return 0;
+}
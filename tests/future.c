@@ -0,0 +1,105 @@
+#include "muco.h"
+#include "muco/future.h"
+#include "muco/join.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Threads that run no scheduler set all the futures of a round at once, while
+// the fiber registers into them with co_future_wait_any, then collects them
+// with co_future_wait_all before the next round reuses the futures. Waiting
+// for a future isn't cancellable, so a child of a cancelled nursery drops its
+// token before it waits.
+
+#define THREADS (4)
+#define ROUNDS (2000)
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+        exit(1); \
+    } \
+} while (0)
+
+static co_future_t futures[THREADS];
+static atomic_int current_round;
+
+static co_future_t detached;
+static void *detached_value;
+
+static void *service(void *arg) {
+    int index = (int)(intptr_t)arg;
+
+    for (int round = 1; round <= ROUNDS; round++) {
+        while (atomic_load(&current_round) < round) {
+            sched_yield();
+        }
+        co_promise_set(&futures[index], (void *)(intptr_t)(round * THREADS + index));
+    }
+    return NULL;
+}
+
+static void wait_detached() {
+    co_set_cancel(NULL);
+    detached_value = co_future_wait(&detached);
+}
+
+static void run() {
+    co_future_t *pointers[THREADS];
+
+    CHECK(co_future_wait_any(NULL, 0) == -1);
+
+    for (int i = 0; i < THREADS; i++) {
+        pointers[i] = &futures[i];
+    }
+
+    for (int round = 1; round <= ROUNDS; round++) {
+        for (int i = 0; i < THREADS; i++) {
+            co_future_init(&futures[i]);
+        }
+        atomic_store(&current_round, round);
+
+        int index = co_future_wait_any(pointers, THREADS);
+        CHECK(index >= 0 && index < THREADS);
+        CHECK(co_future_ready(&futures[index]));
+
+        co_future_wait_all(pointers, THREADS);
+        for (int i = 0; i < THREADS; i++) {
+            CHECK((intptr_t)co_future_wait(&futures[i]) == round * THREADS + i);
+        }
+    }
+
+    co_nursery_t nursery;
+    co_nursery_init(&nursery);
+    co_future_init(&detached);
+    co_nursery_spawn(&nursery, wait_detached);
+    co_nursery_cancel(&nursery);
+    co_yield();
+    co_promise_set(&detached, &detached);
+    co_nursery_wait(&nursery);
+    CHECK(detached_value == &detached);
+
+    co_break();
+}
+
+int main() {
+    pthread_t threads[THREADS];
+
+    for (int i = 0; i < THREADS; i++) {
+        pthread_create(&threads[i], NULL, service, (void *)(intptr_t)i);
+    }
+
+    co_init(co_procs());
+    co_spawn(run);
+    co_run();
+    co_free();
+
+    for (int i = 0; i < THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    printf("future: ok\n");
+    return 0;
+}
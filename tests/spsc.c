@@ -0,0 +1,94 @@
+#include "muco.h"
+#include "muco/join.h"
+#include "muco/spsc.h"
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Values go through a small ring (so both sides park), then a receiver parked
+// on the empty ring and a sender parked on the full ring are cancelled, after
+// which the ring still works.
+
+#define COUNT (100000)
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+        exit(1); \
+    } \
+} while (0)
+
+static co_spsc_t spsc;
+static int result;
+
+static void produce() {
+    for (intptr_t i = 0; i < COUNT; i++) {
+        CHECK(co_spsc_send(&spsc, (void *)i) == 0);
+    }
+}
+
+static void receive() {
+    void *value;
+    result = co_spsc_receive(&spsc, &value);
+}
+
+static void send() {
+    result = co_spsc_send(&spsc, (void *)-1);
+}
+
+// Runs `proc` in a nursery, and cancels it once it's parked on the channel.
+static void cancel_parked(fiber_main_t proc, atomic_int *parked) {
+    co_nursery_t nursery;
+    co_nursery_init(&nursery);
+
+    result = 0;
+    co_nursery_spawn(&nursery, proc);
+    while (!atomic_load(parked)) {
+        co_yield();
+    }
+    co_nursery_cancel(&nursery);
+    co_nursery_wait(&nursery);
+
+    CHECK(result == ECANCELED);
+}
+
+static void run() {
+    void *value;
+
+    co_spsc_init(&spsc, 4);
+    co_spawn(produce);
+    for (intptr_t i = 0; i < COUNT; i++) {
+        CHECK(co_spsc_receive(&spsc, &value) == 0);
+        CHECK((intptr_t)value == i);
+    }
+
+    cancel_parked(receive, &spsc.receiver);
+
+    for (intptr_t i = 0; i < 4; i++) {
+        CHECK(co_spsc_send(&spsc, (void *)i) == 0);
+    }
+    cancel_parked(send, &spsc.sender);
+
+    for (intptr_t i = 0; i < 4; i++) {
+        CHECK(co_spsc_receive(&spsc, &value) == 0);
+        CHECK((intptr_t)value == i);
+    }
+
+    co_spsc_close(&spsc);
+    CHECK(co_spsc_receive(&spsc, &value) == -1);
+    co_spsc_destroy(&spsc);
+
+    co_break();
+}
+
+int main() {
+    co_init(co_procs());
+    co_spawn(run);
+    co_run();
+    co_free();
+
+    printf("spsc: ok\n");
+    return 0;
+}